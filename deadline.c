@@ -0,0 +1,142 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <glib.h>
+
+#include "deadline.h"
+
+typedef struct mupdf_deadline_entry_s
+{
+  fz_cookie* cookie; /**< Watched cookie */
+  gint64 end_time; /**< Monotonic time at which the cookie is aborted */
+  bool fired; /**< If the cookie has been aborted */
+} mupdf_deadline_entry_t;
+
+struct mupdf_deadline_s
+{
+  GThread* thread; /**< Watchdog thread */
+  GMutex mutex; /**< Protects entries and quit */
+  GCond cond; /**< Signalled when entries or quit change */
+  GList* entries; /**< Armed cookies, fired ones are kept until disarmed */
+  bool quit; /**< Tells the thread to exit */
+};
+
+static gpointer
+mupdf_deadline_thread(gpointer data)
+{
+  mupdf_deadline_t* deadline = data;
+
+  g_mutex_lock(&deadline->mutex);
+
+  while (deadline->quit == false) {
+    gint64 now  = g_get_monotonic_time();
+    gint64 next = G_MAXINT64;
+
+    for (GList* iter = deadline->entries; iter != NULL; iter = g_list_next(iter)) {
+      mupdf_deadline_entry_t* entry = iter->data;
+      if (entry->fired == true) {
+        continue;
+      }
+
+      if (entry->end_time <= now) {
+        entry->cookie->abort = 1;
+        entry->fired         = true;
+      } else if (entry->end_time < next) {
+        next = entry->end_time;
+      }
+    }
+
+    if (next == G_MAXINT64) {
+      g_cond_wait(&deadline->cond, &deadline->mutex);
+    } else {
+      g_cond_wait_until(&deadline->cond, &deadline->mutex, next);
+    }
+  }
+
+  g_mutex_unlock(&deadline->mutex);
+
+  return NULL;
+}
+
+mupdf_deadline_t*
+mupdf_deadline_new(void)
+{
+  mupdf_deadline_t* deadline = g_malloc0(sizeof(mupdf_deadline_t));
+
+  g_mutex_init(&deadline->mutex);
+  g_cond_init(&deadline->cond);
+
+  deadline->thread = g_thread_try_new("mupdf-deadline", mupdf_deadline_thread, deadline, NULL);
+  if (deadline->thread == NULL) {
+    g_cond_clear(&deadline->cond);
+    g_mutex_clear(&deadline->mutex);
+    g_free(deadline);
+    return NULL;
+  }
+
+  return deadline;
+}
+
+void
+mupdf_deadline_free(mupdf_deadline_t* deadline)
+{
+  if (deadline == NULL) {
+    return;
+  }
+
+  g_mutex_lock(&deadline->mutex);
+  deadline->quit = true;
+  g_cond_signal(&deadline->cond);
+  g_mutex_unlock(&deadline->mutex);
+
+  g_thread_join(deadline->thread);
+
+  g_list_free_full(deadline->entries, g_free);
+  g_cond_clear(&deadline->cond);
+  g_mutex_clear(&deadline->mutex);
+  g_free(deadline);
+}
+
+void
+mupdf_deadline_arm(mupdf_deadline_t* deadline, fz_cookie* cookie, unsigned int milliseconds)
+{
+  if (deadline == NULL || cookie == NULL) {
+    return;
+  }
+
+  mupdf_deadline_entry_t* entry = g_malloc0(sizeof(mupdf_deadline_entry_t));
+  entry->cookie   = cookie;
+  entry->end_time = g_get_monotonic_time() + (gint64) milliseconds * G_TIME_SPAN_MILLISECOND;
+
+  g_mutex_lock(&deadline->mutex);
+  deadline->entries = g_list_prepend(deadline->entries, entry);
+  g_cond_signal(&deadline->cond);
+  g_mutex_unlock(&deadline->mutex);
+}
+
+bool
+mupdf_deadline_disarm(mupdf_deadline_t* deadline, fz_cookie* cookie)
+{
+  if (deadline == NULL || cookie == NULL) {
+    return false;
+  }
+
+  bool fired = false;
+
+  g_mutex_lock(&deadline->mutex);
+
+  for (GList* iter = deadline->entries; iter != NULL; iter = g_list_next(iter)) {
+    mupdf_deadline_entry_t* entry = iter->data;
+    if (entry->cookie == cookie) {
+      fired             = entry->fired;
+      deadline->entries = g_list_delete_link(deadline->entries, iter);
+      g_free(entry);
+      break;
+    }
+  }
+
+  g_mutex_unlock(&deadline->mutex);
+
+  return fired;
+}
@@ -0,0 +1,45 @@
+/* See LICENSE file for license and copyright information */
+
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include "plugin.h"
+
+/**
+ * Creates a watchdog thread which aborts cookies once their deadline has
+ * passed
+ *
+ * @return The watchdog or NULL if an error occurred
+ */
+mupdf_deadline_t* mupdf_deadline_new(void);
+
+/**
+ * Stops the watchdog thread and frees it
+ *
+ * @param deadline The watchdog
+ */
+void mupdf_deadline_free(mupdf_deadline_t* deadline);
+
+/**
+ * Sets cookie->abort once the given amount of time has passed
+ *
+ * @param deadline The watchdog
+ * @param cookie The cookie, has to stay valid until mupdf_deadline_disarm is
+ *   called
+ * @param milliseconds Time budget
+ */
+void mupdf_deadline_arm(mupdf_deadline_t* deadline, fz_cookie* cookie,
+    unsigned int milliseconds);
+
+/**
+ * Stops watching the cookie. Once this returns the watchdog does not touch
+ * the cookie anymore, so its abort flag is final.
+ *
+ * @param deadline The watchdog
+ * @param cookie The cookie
+ * @return true if the deadline has passed and the cookie has been aborted,
+ *   false if it has not or the cookie was not armed
+ */
+bool mupdf_deadline_disarm(mupdf_deadline_t* deadline, fz_cookie* cookie);
+
+#endif // DEADLINE_H
@@ -0,0 +1,300 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <string.h>
+#include <glib.h>
+#include <mupdf/pdf.h>
+
+#include "dedup.h"
+#include "layer.h"
+#include "streamcache.h"
+#include "utils.h"
+
+/* Nesting depth up to which resource dictionaries are hashed */
+#define MUPDF_HASH_MAX_DEPTH 32
+
+/* Inherited page attributes are looked up at most this many levels up */
+#define MUPDF_HASH_MAX_PARENTS 64
+
+static void
+mupdf_hash_string(GChecksum* checksum, const char* string)
+{
+  g_checksum_update(checksum, (const guchar*) string, strlen(string));
+}
+
+static void
+mupdf_hash_object(fz_context* ctx, GChecksum* checksum, pdf_obj* obj, unsigned int depth)
+{
+  char buffer[64];
+
+  /* references are hashed by identity, shared resources are shared objects */
+  if (obj == NULL) {
+    mupdf_hash_string(checksum, "null");
+  } else if (pdf_is_indirect(ctx, obj)) {
+    g_snprintf(buffer, sizeof(buffer), "R%d.%d", pdf_to_num(ctx, obj), pdf_to_gen(ctx, obj));
+    mupdf_hash_string(checksum, buffer);
+  } else if (depth > MUPDF_HASH_MAX_DEPTH) {
+    mupdf_hash_string(checksum, "?");
+  } else if (pdf_is_bool(ctx, obj)) {
+    mupdf_hash_string(checksum, pdf_to_bool(ctx, obj) ? "true" : "false");
+  } else if (pdf_is_int(ctx, obj)) {
+    g_snprintf(buffer, sizeof(buffer), "i%d", pdf_to_int(ctx, obj));
+    mupdf_hash_string(checksum, buffer);
+  } else if (pdf_is_real(ctx, obj)) {
+    g_snprintf(buffer, sizeof(buffer), "f%g", pdf_to_real(ctx, obj));
+    mupdf_hash_string(checksum, buffer);
+  } else if (pdf_is_name(ctx, obj)) {
+    mupdf_hash_string(checksum, "/");
+    mupdf_hash_string(checksum, pdf_to_name(ctx, obj));
+  } else if (pdf_is_string(ctx, obj)) {
+    mupdf_hash_string(checksum, "(");
+    g_checksum_update(checksum, (const guchar*) pdf_to_str_buf(ctx, obj), pdf_to_str_len(ctx, obj));
+    mupdf_hash_string(checksum, ")");
+  } else if (pdf_is_array(ctx, obj)) {
+    mupdf_hash_string(checksum, "[");
+    int n = pdf_array_len(ctx, obj);
+    for (int i = 0; i < n; i++) {
+      mupdf_hash_object(ctx, checksum, pdf_array_get(ctx, obj, i), depth + 1);
+    }
+    mupdf_hash_string(checksum, "]");
+  } else if (pdf_is_dict(ctx, obj)) {
+    mupdf_hash_string(checksum, "<<");
+    int n = pdf_dict_len(ctx, obj);
+    for (int i = 0; i < n; i++) {
+      mupdf_hash_object(ctx, checksum, pdf_dict_get_key(ctx, obj, i), depth + 1);
+      mupdf_hash_object(ctx, checksum, pdf_dict_get_val(ctx, obj, i), depth + 1);
+    }
+    mupdf_hash_string(checksum, ">>");
+  } else {
+    mupdf_hash_string(checksum, "null");
+  }
+}
+
+static pdf_obj*
+mupdf_lookup_inherited(fz_context* ctx, pdf_obj* node, pdf_obj* key)
+{
+  for (unsigned int i = 0; node != NULL && i < MUPDF_HASH_MAX_PARENTS; i++) {
+    pdf_obj* value = pdf_dict_get(ctx, node, key);
+    if (value != NULL) {
+      return value;
+    }
+    node = pdf_dict_get(ctx, node, PDF_NAME_Parent);
+  }
+
+  return NULL;
+}
+
+/* The stream is hashed as stored, decompressing it would cost as much as
+ * interpreting it. Its filters decide how the bytes are decoded, so they are
+ * part of the hash. */
+static void
+mupdf_hash_stream(fz_context* ctx, pdf_document* document, GChecksum* checksum, pdf_obj* stream)
+{
+  mupdf_hash_object(ctx, checksum, pdf_dict_get(ctx, stream, PDF_NAME_Filter), 0);
+  mupdf_hash_object(ctx, checksum, pdf_dict_get(ctx, stream, PDF_NAME_DecodeParms), 0);
+
+  fz_buffer* buffer = pdf_load_raw_stream(ctx, document, pdf_to_num(ctx, stream), pdf_to_gen(ctx, stream));
+
+  unsigned char* data = NULL;
+  size_t length       = fz_buffer_storage(ctx, buffer, &data);
+  g_checksum_update(checksum, data, length);
+
+  fz_drop_buffer(ctx, buffer);
+}
+
+static char*
+mupdf_page_compute_digest(fz_context* ctx, mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page)
+{
+  pdf_document* document = pdf_specifics(ctx, mupdf_document->document);
+  if (document == NULL) {
+    return NULL;
+  }
+
+  pdf_page* page      = (pdf_page*) mupdf_page->page;
+  GChecksum* checksum = g_checksum_new(G_CHECKSUM_SHA1);
+  char* digest        = NULL;
+
+  /* the content streams are decrypted once for hashing and rendering */
+  mupdf_stream_cache_prepare(ctx, mupdf_document, mupdf_page);
+
+  fz_try (ctx) {
+    char buffer[128];
+    g_snprintf(buffer, sizeof(buffer), "%g %g %g %g", mupdf_page->bbox.x0,
+        mupdf_page->bbox.y0, mupdf_page->bbox.x1, mupdf_page->bbox.y1);
+    mupdf_hash_string(checksum, buffer);
+
+    mupdf_hash_object(ctx, checksum, mupdf_lookup_inherited(ctx, page->me, PDF_NAME_Rotate), 0);
+    mupdf_hash_object(ctx, checksum, mupdf_lookup_inherited(ctx, page->me, PDF_NAME_Resources), 0);
+    mupdf_hash_object(ctx, checksum, pdf_dict_get(ctx, page->me, PDF_NAME_Annots), 0);
+
+    pdf_obj* contents = pdf_dict_get(ctx, page->me, PDF_NAME_Contents);
+    if (pdf_is_array(ctx, contents)) {
+      int n = pdf_array_len(ctx, contents);
+      for (int i = 0; i < n; i++) {
+        mupdf_hash_stream(ctx, document, checksum, pdf_array_get(ctx, contents, i));
+      }
+    } else if (pdf_is_indirect(ctx, contents)) {
+      mupdf_hash_stream(ctx, document, checksum, contents);
+    }
+
+    digest = g_strdup(g_checksum_get_string(checksum));
+  } fz_catch (ctx) {
+    digest = NULL;
+  }
+
+  g_checksum_free(checksum);
+
+  return digest;
+}
+
+void
+mupdf_page_bind_shared(fz_context* ctx, mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page)
+{
+  if (mupdf_page->hashed == true) {
+    return;
+  }
+  mupdf_page->hashed = true;
+
+  char* digest = mupdf_page_compute_digest(ctx, mupdf_document, mupdf_page);
+  if (digest == NULL) {
+    return;
+  }
+
+  mupdf_shared_page_t* shared = g_hash_table_lookup(mupdf_document->shared_pages, digest);
+  if (shared == NULL) {
+    /* the first page donates its text and display list */
+    shared                 = g_malloc0(sizeof(mupdf_shared_page_t));
+    shared->digest         = digest;
+    shared->sheet          = mupdf_page->sheet;
+    shared->text           = mupdf_page->text;
+    shared->extracted_text = mupdf_page->extracted_text;
+    if (mupdf_page->display_list != NULL) {
+      shared->display_list       = fz_keep_display_list(ctx, mupdf_page->display_list);
+      shared->display_list_state = mupdf_page->display_list_state;
+    }
+
+    g_hash_table_insert(mupdf_document->shared_pages, digest, shared);
+  } else {
+    g_free(digest);
+
+    if (mupdf_page->text != NULL) {
+      fz_drop_stext_page(ctx, mupdf_page->text);
+    }
+    if (mupdf_page->sheet != NULL) {
+      fz_drop_stext_sheet(ctx, mupdf_page->sheet);
+    }
+
+    mupdf_page->sheet          = shared->sheet;
+    mupdf_page->text           = shared->text;
+    mupdf_page->extracted_text = shared->extracted_text;
+    if (mupdf_page->display_list == NULL && shared->display_list != NULL) {
+      mupdf_page->display_list       = fz_keep_display_list(ctx, shared->display_list);
+      mupdf_page->display_list_state = shared->display_list_state;
+    }
+  }
+
+  shared->ref_count++;
+  mupdf_page->shared = shared;
+}
+
+void
+mupdf_page_release_shared(fz_context* ctx, mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page)
+{
+  mupdf_shared_page_t* shared = mupdf_page->shared;
+  if (shared == NULL) {
+    return;
+  }
+
+  mupdf_page->shared = NULL;
+  mupdf_page->sheet  = NULL;
+  mupdf_page->text   = NULL;
+
+  if (--shared->ref_count > 0) {
+    return;
+  }
+
+  g_hash_table_remove(mupdf_document->shared_pages, shared->digest);
+
+  fz_drop_display_list(ctx, shared->display_list);
+  if (shared->text != NULL) {
+    fz_drop_stext_page(ctx, shared->text);
+  }
+  if (shared->sheet != NULL) {
+    fz_drop_stext_sheet(ctx, shared->sheet);
+  }
+  g_free(shared->raster);
+  mupdf_layer_raster_unref(shared->content_raster);
+  g_free(shared);
+}
+
+bool
+mupdf_page_copy_shared_raster(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, unsigned char* image, int rowstride,
+    unsigned int width, unsigned int height, double scalex, double scaley,
+    fz_cookie* cookie)
+{
+  bool copied = false;
+
+  if (mupdf_document_lock_abortable(mupdf_document, cookie) == false) {
+    return false;
+  }
+
+  mupdf_page_bind_shared(ctx, mupdf_document, mupdf_page);
+
+  mupdf_shared_page_t* shared = mupdf_page->shared;
+  if (shared != NULL && shared->raster != NULL &&
+      shared->raster_width == width && shared->raster_height == height &&
+      shared->raster_rowstride == rowstride &&
+      shared->raster_scalex == scalex && shared->raster_scaley == scaley) {
+    memcpy(image, shared->raster, (size_t) rowstride * height);
+    copied = true;
+  }
+
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  return copied;
+}
+
+void
+mupdf_page_store_shared_raster(mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, const unsigned char* image, int rowstride,
+    unsigned int width, unsigned int height, double scalex, double scaley,
+    unsigned int generation, fz_cookie* cookie)
+{
+  if (mupdf_document_lock_abortable(mupdf_document, cookie) == false) {
+    return;
+  }
+
+  /* only worth the memory if another page can use it, and only if the
+   * rasters have not been dropped while rendering */
+  mupdf_shared_page_t* shared = mupdf_page->shared;
+  if (shared != NULL && shared->ref_count > 1 &&
+      generation == mupdf_document->raster_generation) {
+    g_free(shared->raster);
+    shared->raster           = g_memdup(image, (guint) rowstride * height);
+    shared->raster_width     = width;
+    shared->raster_height    = height;
+    shared->raster_rowstride = rowstride;
+    shared->raster_scalex    = scalex;
+    shared->raster_scaley    = scaley;
+  }
+
+  g_mutex_unlock(&mupdf_document->mutex);
+}
+
+void
+mupdf_shared_pages_clear_rasters(mupdf_document_t* mupdf_document)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init(&iter, mupdf_document->shared_pages);
+  while (g_hash_table_iter_next(&iter, NULL, &value) == TRUE) {
+    mupdf_shared_page_t* shared = value;
+    g_free(shared->raster);
+    shared->raster = NULL;
+    mupdf_layer_raster_unref(shared->content_raster);
+    shared->content_raster = NULL;
+  }
+}
@@ -0,0 +1,103 @@
+/* See LICENSE file for license and copyright information */
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include "plugin.h"
+
+/**
+ * Results shared between pages whose content streams, resources and
+ * geometry hash to the same digest. Protected by the document mutex.
+ */
+struct mupdf_shared_page_s
+{
+  char* digest; /**< Content digest, key in the document's table */
+  unsigned int ref_count; /**< Number of pages bound to this entry */
+  fz_display_list* display_list; /**< Shared display list */
+  const char* display_list_state; /**< Layer state the display list was recorded in */
+  fz_stext_sheet* sheet; /**< Shared text sheet */
+  fz_stext_page* text; /**< Shared page text */
+  bool extracted_text; /**< If the shared text has been extracted */
+  unsigned char* raster; /**< Last complete raster */
+  unsigned int raster_width; /**< Width of the raster */
+  unsigned int raster_height; /**< Height of the raster */
+  int raster_rowstride; /**< Rowstride of the raster */
+  double raster_scalex; /**< Horizontal scale of the raster */
+  double raster_scaley; /**< Vertical scale of the raster */
+  mupdf_layer_raster_t* content_raster; /**< Content layer raster, see layer.h */
+};
+
+/**
+ * Hashes the page once and binds it to the results of identical pages. The
+ * page's text then aliases the shared text and a shared display list is
+ * adopted. Has to be called with the document mutex held.
+ *
+ * @param ctx Context of the calling thread
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ */
+void mupdf_page_bind_shared(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page);
+
+/**
+ * Releases the page's reference to the shared results. Has to be called with
+ * the document mutex held.
+ *
+ * @param ctx Context of the calling thread
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ */
+void mupdf_page_release_shared(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page);
+
+/**
+ * Copies the raster of an identical page rendered with the same parameters
+ *
+ * @param ctx Context of the calling thread
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ * @param image Target buffer
+ * @param rowstride Rowstride of the target buffer
+ * @param width Width of the target buffer
+ * @param height Height of the target buffer
+ * @param scalex Horizontal scale
+ * @param scaley Vertical scale
+ * @param cookie Cookie of the render or NULL; nothing is copied if it is
+ *   aborted while waiting for the document mutex
+ * @return true if the raster has been copied, otherwise false
+ */
+bool mupdf_page_copy_shared_raster(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, unsigned char* image, int rowstride,
+    unsigned int width, unsigned int height, double scalex, double scaley,
+    fz_cookie* cookie);
+
+/**
+ * Keeps a copy of a complete raster for identical pages
+ *
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ * @param image Rendered buffer
+ * @param rowstride Rowstride of the buffer
+ * @param width Width of the buffer
+ * @param height Height of the buffer
+ * @param scalex Horizontal scale
+ * @param scaley Vertical scale
+ * @param generation Raster generation the render started in, see
+ *   mupdf_document_raster_generation
+ * @param cookie Cookie of the render or NULL; nothing is kept if it is
+ *   aborted while waiting for the document mutex
+ */
+void mupdf_page_store_shared_raster(mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, const unsigned char* image, int rowstride,
+    unsigned int width, unsigned int height, double scalex, double scaley,
+    unsigned int generation, fz_cookie* cookie);
+
+/**
+ * Drops the shared rasters of all pages, e.g. because the visible layers
+ * changed. Has to be called with the document mutex held.
+ *
+ * @param mupdf_document Document
+ */
+void mupdf_shared_pages_clear_rasters(mupdf_document_t* mupdf_document);
+
+#endif // DEDUP_H
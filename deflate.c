@@ -0,0 +1,251 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <glib.h>
+#include <zlib.h>
+
+#include "deflate.h"
+
+typedef struct mupdf_deflate_item_s
+{
+  int num; /**< Object number of the stream */
+  fz_buffer* source; /**< Uncompressed data */
+  unsigned char* source_data; /**< Storage of source */
+  size_t source_size; /**< Size of source */
+  unsigned char* data; /**< Compressed data or NULL if it is not smaller */
+  uLongf size; /**< Size of data */
+} mupdf_deflate_item_t;
+
+typedef struct mupdf_deflate_original_s
+{
+  int num; /**< Object number of the stream */
+  pdf_obj* dict; /**< Copy of its dictionary before compressing */
+  fz_buffer* buffer; /**< Its stream buffer before compressing or NULL */
+} mupdf_deflate_original_t;
+
+typedef struct mupdf_deflate_batch_s
+{
+  GMutex mutex; /**< Protects pending */
+  GCond cond; /**< Signalled when pending drops to 0 */
+  unsigned int pending; /**< Number of items still being compressed */
+} mupdf_deflate_batch_t;
+
+/* Runs on the pool's threads and only uses zlib, never the document */
+static void
+mupdf_deflate_item(gpointer data, gpointer user_data)
+{
+  mupdf_deflate_item_t* item   = data;
+  mupdf_deflate_batch_t* batch = user_data;
+
+  uLongf size          = compressBound(item->source_size);
+  unsigned char* bytes = g_malloc(size);
+
+  if (compress2(bytes, &size, item->source_data, item->source_size,
+        Z_DEFAULT_COMPRESSION) == Z_OK && size < item->source_size) {
+    item->data = bytes;
+    item->size = size;
+  } else {
+    g_free(bytes);
+  }
+
+  g_mutex_lock(&batch->mutex);
+  if (--batch->pending == 0) {
+    g_cond_signal(&batch->cond);
+  }
+  g_mutex_unlock(&batch->mutex);
+}
+
+/* Loads the data of a stream without filter, NULL for other objects */
+static fz_buffer*
+mupdf_deflate_load(fz_context* ctx, pdf_document* document, int num)
+{
+  fz_buffer* buffer = NULL;
+  pdf_obj* object   = NULL;
+
+  fz_var(buffer);
+  fz_var(object);
+
+  fz_try (ctx) {
+    if (pdf_obj_num_is_stream(ctx, document, num) != 0) {
+      object = pdf_load_object(ctx, document, num);
+
+      /* cross reference and object streams are rebuilt by the writer */
+      pdf_obj* type = pdf_dict_get(ctx, object, PDF_NAME_Type);
+      if (pdf_dict_get(ctx, object, PDF_NAME_Filter) == NULL &&
+          pdf_name_eq(ctx, type, PDF_NAME_XRef) == 0 &&
+          pdf_name_eq(ctx, type, PDF_NAME_ObjStm) == 0) {
+        buffer = pdf_load_stream_number(ctx, document, num);
+      }
+    }
+  } fz_always (ctx) {
+    pdf_drop_obj(ctx, object);
+  } fz_catch (ctx) {
+    buffer = NULL;
+  }
+
+  return buffer;
+}
+
+static void
+mupdf_deflate_store(fz_context* ctx, pdf_document* document,
+    mupdf_deflate_item_t* item, GArray* originals)
+{
+  fz_buffer* buffer                 = NULL;
+  pdf_obj* object                   = NULL;
+  mupdf_deflate_original_t original = { .dict = NULL };
+
+  fz_var(buffer);
+  fz_var(object);
+  fz_var(original);
+
+  fz_try (ctx) {
+    buffer = fz_new_buffer(ctx, item->size);
+    fz_append_data(ctx, buffer, item->data, item->size);
+
+    object = pdf_load_object(ctx, document, item->num);
+
+    pdf_xref_entry* x = pdf_get_xref_entry(ctx, document, item->num);
+    original.num      = item->num;
+    original.dict     = pdf_copy_dict(ctx, object);
+    original.buffer   = fz_keep_buffer(ctx, x->stm_buf);
+
+    /* the array owns the original from here on */
+    g_array_append_val(originals, original);
+    original = (mupdf_deflate_original_t) { .dict = NULL };
+
+    pdf_dict_put(ctx, object, PDF_NAME_Filter, PDF_NAME_FlateDecode);
+    pdf_dict_del(ctx, object, PDF_NAME_DecodeParms);
+    pdf_update_stream(ctx, document, object, buffer, 1);
+  } fz_always (ctx) {
+    pdf_drop_obj(ctx, object);
+    fz_drop_buffer(ctx, buffer);
+  } fz_catch (ctx) {
+    /* the stream is written uncompressed, or restored if it was changed */
+    pdf_drop_obj(ctx, original.dict);
+    fz_drop_buffer(ctx, original.buffer);
+  }
+}
+
+GArray*
+mupdf_document_deflate_streams(fz_context* ctx, pdf_document* document,
+    fz_cookie* cookie)
+{
+  GArray* originals = g_array_new(FALSE, FALSE, sizeof(mupdf_deflate_original_t));
+
+  mupdf_deflate_batch_t batch = { .pending = 0 };
+  g_mutex_init(&batch.mutex);
+  g_cond_init(&batch.cond);
+
+  GThreadPool* pool = g_thread_pool_new(mupdf_deflate_item, &batch,
+      g_get_num_processors(), FALSE, NULL);
+  if (pool == NULL) {
+    goto error_free;
+  }
+
+  GArray* items = g_array_new(FALSE, TRUE, sizeof(mupdf_deflate_item_t));
+  int n_objects = pdf_xref_len(ctx, document);
+
+  for (int num = 1; num < n_objects && (cookie == NULL || cookie->abort == 0);) {
+    /* reading needs the document, so it happens here */
+    size_t batch_size = 0;
+    g_array_set_size(items, 0);
+
+    for (; num < n_objects && batch_size < MUPDF_DEFLATE_BATCH_SIZE; num++) {
+      fz_buffer* buffer = mupdf_deflate_load(ctx, document, num);
+      if (buffer == NULL) {
+        continue;
+      }
+
+      mupdf_deflate_item_t item = { .num = num, .source = buffer };
+      item.source_size = fz_buffer_storage(ctx, buffer, &item.source_data);
+
+      batch_size += item.source_size;
+
+      g_array_append_val(items, item);
+    }
+
+    /* the array does not grow while the pool works on its items */
+    batch.pending = items->len;
+    for (unsigned int i = 0; i < items->len; i++) {
+      g_thread_pool_push(pool, &g_array_index(items, mupdf_deflate_item_t, i), NULL);
+    }
+
+    g_mutex_lock(&batch.mutex);
+    while (batch.pending > 0) {
+      g_cond_wait(&batch.cond, &batch.mutex);
+    }
+    g_mutex_unlock(&batch.mutex);
+
+    for (unsigned int i = 0; i < items->len; i++) {
+      mupdf_deflate_item_t* item = &g_array_index(items, mupdf_deflate_item_t, i);
+      if (item->data != NULL) {
+        mupdf_deflate_store(ctx, document, item, originals);
+      }
+
+      fz_drop_buffer(ctx, item->source);
+      g_free(item->data);
+    }
+  }
+
+  g_array_free(items, TRUE);
+  g_thread_pool_free(pool, FALSE, TRUE);
+
+error_free:
+
+  g_cond_clear(&batch.cond);
+  g_mutex_clear(&batch.mutex);
+
+  return originals;
+}
+
+void
+mupdf_document_deflate_restore(fz_context* ctx, pdf_document* document,
+    GArray* originals)
+{
+  if (originals == NULL) {
+    return;
+  }
+
+  pdf_obj* keys[] = {
+    PDF_NAME_Filter,
+    PDF_NAME_DecodeParms,
+    PDF_NAME_Length
+  };
+
+  for (unsigned int i = 0; i < originals->len; i++) {
+    mupdf_deflate_original_t* original = &g_array_index(originals, mupdf_deflate_original_t, i);
+    pdf_obj* object                    = NULL;
+
+    /* a copy that is dropped next only has its originals freed */
+    if (document != NULL) {
+      fz_var(object);
+
+      fz_try (ctx) {
+        object = pdf_load_object(ctx, document, original->num);
+        for (unsigned int k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+          pdf_obj* value = pdf_dict_get(ctx, original->dict, keys[k]);
+          if (value != NULL) {
+            pdf_dict_put(ctx, object, keys[k], value);
+          } else {
+            pdf_dict_del(ctx, object, keys[k]);
+          }
+        }
+
+        /* without a buffer the stream is read from the file again */
+        pdf_xref_entry* x = pdf_get_xref_entry(ctx, document, original->num);
+        fz_drop_buffer(ctx, x->stm_buf);
+        x->stm_buf       = original->buffer;
+        original->buffer = NULL;
+      } fz_always (ctx) {
+        pdf_drop_obj(ctx, object);
+      } fz_catch (ctx) {
+      }
+    }
+
+    fz_drop_buffer(ctx, original->buffer);
+    pdf_drop_obj(ctx, original->dict);
+  }
+
+  g_array_free(originals, TRUE);
+}
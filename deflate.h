@@ -0,0 +1,43 @@
+/* See LICENSE file for license and copyright information */
+
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <glib.h>
+#include <mupdf/pdf.h>
+
+#include "plugin.h"
+
+/** Uncompressed bytes read from the document per batch of streams */
+#define MUPDF_DEFLATE_BATCH_SIZE (64 * 1024 * 1024)
+
+/**
+ * Compresses every stream of the document that has no filter with the flate
+ * filter. The streams are read in batches, deflated on one thread per
+ * processor and written back in object order. Streams that do not get
+ * smaller are kept as they are. The document is changed, so a shared
+ * document needs its mutex held.
+ *
+ * @param ctx Context of the calling thread
+ * @param document The document
+ * @param cookie Cookie checked between batches to abort, or NULL
+ * @return The original streams, to be passed to
+ *   mupdf_document_deflate_restore once the document has been written
+ */
+GArray* mupdf_document_deflate_streams(fz_context* ctx, pdf_document* document,
+    fz_cookie* cookie);
+
+/**
+ * Puts the original streams back into the document, so that it is not
+ * inflated on every render and does not keep the compressed data after it
+ * has been saved. Has to be called with the document mutex held.
+ *
+ * @param ctx Context of the calling thread
+ * @param document The document, or NULL to only free originals when the
+ *   document is dropped anyway
+ * @param originals Result of mupdf_document_deflate_streams (freed) or NULL
+ */
+void mupdf_document_deflate_restore(fz_context* ctx, pdf_document* document,
+    GArray* originals);
+
+#endif // DEFLATE_H
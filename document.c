@@ -8,9 +8,54 @@
 #include <glib-2.0/glib.h>
 
 #include "plugin.h"
+#include "deadline.h"
+#include "registry.h"
+#include "save.h"
+#include "scheduler.h"
+#include "streamcache.h"
+#include "utils.h"
+#include "xobject.h"
 
 #define LENGTH(x) (sizeof(x)/sizeof((x)[0]))
 
+static void
+mupdf_document_lock(void* user, int lock)
+{
+  mupdf_document_t* mupdf_document = user;
+  g_mutex_lock(&mupdf_document->lock_mutexes[lock]);
+}
+
+static void
+mupdf_document_unlock(void* user, int lock)
+{
+  mupdf_document_t* mupdf_document = user;
+  g_mutex_unlock(&mupdf_document->lock_mutexes[lock]);
+}
+
+static void
+mupdf_document_init_locks(mupdf_document_t* mupdf_document)
+{
+  for (unsigned int i = 0; i < FZ_LOCK_MAX; i++) {
+    g_mutex_init(&mupdf_document->lock_mutexes[i]);
+  }
+  g_mutex_init(&mupdf_document->mutex);
+  g_mutex_init(&mupdf_document->context_mutex);
+
+  mupdf_document->locks.user   = mupdf_document;
+  mupdf_document->locks.lock   = mupdf_document_lock;
+  mupdf_document->locks.unlock = mupdf_document_unlock;
+}
+
+static void
+mupdf_document_clear_locks(mupdf_document_t* mupdf_document)
+{
+  for (unsigned int i = 0; i < FZ_LOCK_MAX; i++) {
+    g_mutex_clear(&mupdf_document->lock_mutexes[i]);
+  }
+  g_mutex_clear(&mupdf_document->mutex);
+  g_mutex_clear(&mupdf_document->context_mutex);
+}
+
 zathura_error_t
 pdf_document_open(zathura_document_t* document)
 {
@@ -26,7 +71,10 @@ pdf_document_open(zathura_document_t* document)
     goto error_ret;
   }
 
-  mupdf_document->ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+  /* the locks allow cloned contexts to be used from worker threads */
+  mupdf_document_init_locks(mupdf_document);
+
+  mupdf_document->ctx = fz_new_context(NULL, &mupdf_document->locks, FZ_STORE_DEFAULT);
   if (mupdf_document->ctx == NULL) {
     error = ZATHURA_ERROR_UNKNOWN;
     goto error_free;
@@ -59,9 +107,28 @@ pdf_document_open(zathura_document_t* document)
     }
   }
 
+  mupdf_document->password = g_strdup(password);
+
   zathura_document_set_number_of_pages(document, fz_count_pages(mupdf_document->ctx, mupdf_document->document));
   zathura_document_set_data(document, mupdf_document);
 
+  mupdf_document->device_scalex = 1.0;
+  mupdf_document->device_scaley = 1.0;
+
+  mupdf_document->stream_cache = mupdf_stream_cache_new(mupdf_document->ctx, mupdf_document->document);
+
+  mupdf_document->scheduler = mupdf_scheduler_new(mupdf_document, 0);
+  mupdf_document->registry  = mupdf_registry_new(path);
+
+  /* the document's own context is only used to open and free it */
+  mupdf_document->thread_contexts = g_hash_table_new_full(g_direct_hash,
+      g_direct_equal, NULL, (GDestroyNotify) fz_drop_context);
+
+  mupdf_document->shared_pages = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  mupdf_document->form_cache   = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  g_queue_init(&mupdf_document->pyramid_pages);
+  g_queue_init(&mupdf_document->layer_pages);
+
   return error;
 
 error_free:
@@ -74,6 +141,7 @@ error_free:
       fz_drop_context(mupdf_document->ctx);
     }
 
+    mupdf_document_clear_locks(mupdf_document);
     free(mupdf_document);
   }
 
@@ -91,8 +159,22 @@ pdf_document_free(zathura_document_t* document, mupdf_document_t* mupdf_document
     return ZATHURA_ERROR_INVALID_ARGUMENTS;
   }
 
+  mupdf_document_wait_save(mupdf_document);
+  mupdf_scheduler_free(mupdf_document->scheduler);
+  mupdf_deadline_free(mupdf_document->deadline);
+  mupdf_registry_free(mupdf_document->registry);
+  g_hash_table_destroy(mupdf_document->shared_pages);
+  mupdf_form_cache_clear(mupdf_document->ctx, mupdf_document);
+  g_queue_clear(&mupdf_document->pyramid_pages);
+  g_queue_clear(&mupdf_document->layer_pages);
+  mupdf_stream_cache_free(mupdf_document->ctx, mupdf_document->document,
+      mupdf_document->stream_cache);
+
   fz_drop_document(mupdf_document->ctx, mupdf_document->document);
+  g_hash_table_destroy(mupdf_document->thread_contexts);
   fz_drop_context(mupdf_document->ctx);
+  mupdf_document_clear_locks(mupdf_document);
+  g_free(mupdf_document->password);
   free(mupdf_document);
   zathura_document_set_data(document, NULL);
 
@@ -107,15 +189,39 @@ pdf_document_save_as(zathura_document_t* document, mupdf_document_t*
     return ZATHURA_ERROR_INVALID_ARGUMENTS;
   }
 
-  fz_try (mupdf_document->ctx) {
-    pdf_save_document(mupdf_document->ctx, (pdf_document*) mupdf_document->document, (char*) path, NULL);
-  } fz_catch (mupdf_document->ctx) {
+  mupdf_document_wait_save(mupdf_document);
+
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
     return ZATHURA_ERROR_UNKNOWN;
   }
 
+  return mupdf_document_save(ctx, mupdf_document, path, NULL, NULL);
+}
+
+zathura_error_t
+pdf_document_set_viewport(mupdf_document_t* mupdf_document,
+    unsigned int first_page, unsigned int last_page)
+{
+  if (mupdf_document == NULL || first_page > last_page) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  mupdf_scheduler_set_viewport(mupdf_document->scheduler, first_page, last_page);
+
   return ZATHURA_ERROR_OK;
 }
 
+unsigned int
+pdf_document_get_pending_jobs(mupdf_document_t* mupdf_document)
+{
+  if (mupdf_document == NULL) {
+    return 0;
+  }
+
+  return mupdf_scheduler_get_queue_depth(mupdf_document->scheduler);
+}
+
 girara_list_t*
 pdf_document_get_information(zathura_document_t* document, mupdf_document_t*
     mupdf_document, zathura_error_t* error)
@@ -124,6 +230,15 @@ pdf_document_get_information(zathura_document_t* document, mupdf_document_t*
     if (error != NULL) {
       *error = ZATHURA_ERROR_INVALID_ARGUMENTS;
     }
+    return NULL;
+  }
+
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_UNKNOWN;
+    }
+    return NULL;
   }
 
   girara_list_t* list = zathura_document_information_entry_list_new();
@@ -134,9 +249,11 @@ pdf_document_get_information(zathura_document_t* document, mupdf_document_t*
     return NULL;
   }
 
-  fz_try (mupdf_document->ctx) {
-    pdf_obj* trailer = pdf_trailer(mupdf_document->ctx, (pdf_document*) mupdf_document->document);
-    pdf_obj* info_dict = pdf_dict_get(mupdf_document->ctx, trailer, PDF_NAME_Info);
+  g_mutex_lock(&mupdf_document->mutex);
+
+  fz_try (ctx) {
+    pdf_obj* trailer = pdf_trailer(ctx, (pdf_document*) mupdf_document->document);
+    pdf_obj* info_dict = pdf_dict_get(ctx, trailer, PDF_NAME_Info);
 
     /* get string values */
     typedef struct info_value_s {
@@ -154,12 +271,12 @@ pdf_document_get_information(zathura_document_t* document, mupdf_document_t*
     };
 
     for (unsigned int i = 0; i < LENGTH(string_values); i++) {
-      pdf_obj* value = pdf_dict_gets(mupdf_document->ctx, info_dict, string_values[i].property);
+      pdf_obj* value = pdf_dict_gets(ctx, info_dict, string_values[i].property);
       if (value == NULL) {
         continue;
       }
 
-      char* str_value = pdf_to_str_buf(mupdf_document->ctx, value);
+      char* str_value = pdf_to_str_buf(ctx, value);
       if (str_value == NULL || strlen(str_value) == 0) {
         continue;
       }
@@ -181,12 +298,12 @@ pdf_document_get_information(zathura_document_t* document, mupdf_document_t*
     };
 
     for (unsigned int i = 0; i < LENGTH(time_values); i++) {
-      pdf_obj* value = pdf_dict_gets(mupdf_document->ctx, info_dict, time_values[i].property);
+      pdf_obj* value = pdf_dict_gets(ctx, info_dict, time_values[i].property);
       if (value == NULL) {
         continue;
       }
 
-      char* str_value = pdf_to_str_buf(mupdf_document->ctx, value);
+      char* str_value = pdf_to_str_buf(ctx, value);
       if (str_value == NULL || strlen(str_value) == 0) {
         continue;
       }
@@ -201,7 +318,9 @@ pdf_document_get_information(zathura_document_t* document, mupdf_document_t*
         girara_list_append(list, entry);
       }
     }
-  } fz_catch (mupdf_document->ctx) {
+  } fz_always (ctx) {
+    g_mutex_unlock(&mupdf_document->mutex);
+  } fz_catch (ctx) {
     if (error != NULL) {
       *error = ZATHURA_ERROR_UNKNOWN;
     }
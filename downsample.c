@@ -0,0 +1,472 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+#include <zlib.h>
+
+#include "downsample.h"
+
+/* Form XObjects are followed this deep for images */
+#define MUPDF_DOWNSAMPLE_MAX_DEPTH 8
+
+/* Images resampled per thread and batch, bounding the results kept */
+#define MUPDF_DOWNSAMPLE_BATCH_ITEMS 4
+
+typedef struct mupdf_downsample_extent_s
+{
+  pdf_obj* image; /**< Reference to the image */
+  fz_image* loaded; /**< The image as it is passed to devices or NULL */
+  float width; /**< Largest drawn length of the image's horizontal edge */
+  float height; /**< Largest drawn length of the image's vertical edge */
+  bool unmeasured; /**< Used on a page that could not be run completely */
+} mupdf_downsample_extent_t;
+
+typedef struct mupdf_downsample_device_s
+{
+  fz_device super; /**< Device */
+  GHashTable* drawn; /**< Extents by their loaded image */
+} mupdf_downsample_device_t;
+
+typedef struct mupdf_downsample_item_s
+{
+  pdf_obj* image; /**< Reference to the image */
+  fz_image* decoder; /**< Image holding its own copy of the stream data */
+  int width; /**< Target width */
+  int height; /**< Target height */
+  size_t original_size; /**< Length of the original stream */
+  unsigned char* data; /**< Compressed samples or NULL if not smaller */
+  uLongf size; /**< Size of data */
+  int result_width; /**< Width of the compressed samples */
+  int result_height; /**< Height of the compressed samples */
+} mupdf_downsample_item_t;
+
+typedef struct mupdf_downsample_original_s
+{
+  pdf_obj* image; /**< Reference to the image */
+  pdf_obj* dict; /**< Copy of its dictionary before resampling */
+  fz_buffer* buffer; /**< Its stream buffer before resampling or NULL */
+} mupdf_downsample_original_t;
+
+typedef struct mupdf_downsample_batch_s
+{
+  fz_context* ctx; /**< Context the workers clone */
+  GMutex mutex; /**< Protects pending */
+  GCond cond; /**< Signalled when pending drops to 0 */
+  unsigned int pending; /**< Number of items still being resampled */
+} mupdf_downsample_batch_t;
+
+static void
+mupdf_downsample_fill_image(fz_context* ctx, fz_device* device,
+    fz_image* image, const fz_matrix* ctm, float alpha)
+{
+  mupdf_downsample_device_t* downsample = (mupdf_downsample_device_t*) device;
+  mupdf_downsample_extent_t* extent     = g_hash_table_lookup(downsample->drawn, image);
+  if (extent == NULL) {
+    return;
+  }
+
+  /* ctm maps the unit square onto the drawn image, cropped or not */
+  extent->width  = MAX(extent->width, sqrtf(ctm->a * ctm->a + ctm->b * ctm->b));
+  extent->height = MAX(extent->height, sqrtf(ctm->c * ctm->c + ctm->d * ctm->d));
+}
+
+static void
+mupdf_downsample_collect(fz_context* ctx, pdf_document* document,
+    pdf_obj* resources, GHashTable* images, GHashTable* drawn,
+    GHashTable* forms, GPtrArray* used, unsigned int depth)
+{
+  pdf_obj* xobjects = pdf_dict_get(ctx, resources, PDF_NAME_XObject);
+  int n             = pdf_dict_len(ctx, xobjects);
+
+  for (int i = 0; i < n; i++) {
+    pdf_obj* xobject = pdf_dict_get_val(ctx, xobjects, i);
+    if (pdf_is_indirect(ctx, xobject) == 0) {
+      continue;
+    }
+
+    int num          = pdf_to_num(ctx, xobject);
+    pdf_obj* subtype = pdf_dict_get(ctx, xobject, PDF_NAME_Subtype);
+
+    if (pdf_name_eq(ctx, subtype, PDF_NAME_Image)) {
+      mupdf_downsample_extent_t* extent = g_hash_table_lookup(images, GINT_TO_POINTER(num));
+      if (extent == NULL) {
+        extent        = g_malloc0(sizeof(mupdf_downsample_extent_t));
+        extent->image = pdf_keep_obj(ctx, xobject);
+        g_hash_table_insert(images, GINT_TO_POINTER(num), extent);
+
+        /* the store hands the same image to the page while it is kept */
+        fz_try (ctx) {
+          extent->loaded = pdf_load_image(ctx, document, xobject);
+          g_hash_table_insert(drawn, extent->loaded, extent);
+        } fz_catch (ctx) {
+          /* an image that cannot be loaded is never measured and kept */
+        }
+      }
+
+      g_ptr_array_add(used, extent);
+    } else if (pdf_name_eq(ctx, subtype, PDF_NAME_Form) &&
+        depth < MUPDF_DOWNSAMPLE_MAX_DEPTH &&
+        g_hash_table_add(forms, GINT_TO_POINTER(num)) == TRUE) {
+      mupdf_downsample_collect(ctx, document, pdf_dict_get(ctx, xobject, PDF_NAME_Resources),
+          images, drawn, forms, used, depth + 1);
+    }
+  }
+}
+
+/* Measures every image of the page where the page draws it */
+static void
+mupdf_downsample_collect_page(fz_context* ctx, pdf_document* document,
+    int index, GHashTable* images, GHashTable* drawn)
+{
+  fz_page* page                         = NULL;
+  mupdf_downsample_device_t* downsample = NULL;
+  GHashTable* forms                     = g_hash_table_new(g_direct_hash, g_direct_equal);
+  GPtrArray* used                       = g_ptr_array_new();
+
+  fz_var(page);
+  fz_var(downsample);
+
+  fz_try (ctx) {
+    page = fz_load_page(ctx, &document->super, index);
+
+    mupdf_downsample_collect(ctx, document, ((pdf_page*) page)->resources,
+        images, drawn, forms, used, 0);
+
+    downsample                   = fz_new_derived_device(ctx, mupdf_downsample_device_t);
+    downsample->super.fill_image = mupdf_downsample_fill_image;
+    downsample->drawn            = drawn;
+
+    fz_run_page(ctx, page, &downsample->super, &fz_identity, NULL);
+    fz_close_device(ctx, &downsample->super);
+  } fz_always (ctx) {
+    fz_drop_device(ctx, (fz_device*) downsample);
+    fz_drop_page(ctx, page);
+  } fz_catch (ctx) {
+    /* the page may draw its images larger than measured, so they are kept */
+    for (unsigned int i = 0; i < used->len; i++) {
+      ((mupdf_downsample_extent_t*) g_ptr_array_index(used, i))->unmeasured = true;
+    }
+  }
+
+  g_ptr_array_free(used, TRUE);
+  g_hash_table_destroy(forms);
+}
+
+static bool
+mupdf_downsample_is_supported(fz_context* ctx, pdf_obj* image)
+{
+  if (pdf_to_bool(ctx, pdf_dict_get(ctx, image, PDF_NAME_ImageMask)) ||
+      pdf_dict_get(ctx, image, PDF_NAME_Mask) != NULL ||
+      pdf_dict_get(ctx, image, PDF_NAME_Decode) != NULL ||
+      pdf_to_int(ctx, pdf_dict_get(ctx, image, PDF_NAME_BitsPerComponent)) != 8) {
+    return false;
+  }
+
+  /* the color space is kept, so the samples must not be converted */
+  pdf_obj* colorspace = pdf_dict_get(ctx, image, PDF_NAME_ColorSpace);
+  if (pdf_name_eq(ctx, colorspace, PDF_NAME_DeviceGray) ||
+      pdf_name_eq(ctx, colorspace, PDF_NAME_DeviceRGB) ||
+      pdf_name_eq(ctx, colorspace, PDF_NAME_DeviceCMYK)) {
+    return true;
+  }
+
+  return pdf_is_array(ctx, colorspace) &&
+    pdf_name_eq(ctx, pdf_array_get(ctx, colorspace, 0), PDF_NAME_ICCBased);
+}
+
+/* Reads everything the workers need from the document */
+static bool
+mupdf_downsample_prepare(fz_context* ctx, pdf_document* document,
+    const mupdf_downsample_extent_t* extent, unsigned int dpi,
+    mupdf_downsample_item_t* item)
+{
+  bool ready = false;
+
+  fz_var(ready);
+
+  fz_try (ctx) {
+    pdf_obj* image = extent->image;
+    int width      = pdf_to_int(ctx, pdf_dict_get(ctx, image, PDF_NAME_Width));
+    int height     = pdf_to_int(ctx, pdf_dict_get(ctx, image, PDF_NAME_Height));
+
+    if (width > 0 && height > 0 && extent->width > 0 && extent->height > 0 &&
+        extent->unmeasured == false &&
+        mupdf_downsample_is_supported(ctx, image) == true) {
+      float resolution = MIN(width * 72 / extent->width, height * 72 / extent->height);
+
+      if (resolution > dpi * MUPDF_DOWNSAMPLE_THRESHOLD) {
+        float scale = dpi / resolution;
+
+        item->image         = image;
+        item->width         = MAX(1, (int) (width * scale + 0.5));
+        item->height        = MAX(1, (int) (height * scale + 0.5));
+        item->original_size = pdf_to_int(ctx, pdf_dict_get(ctx, image, PDF_NAME_Length));
+        item->decoder       = (extent->loaded != NULL) ?
+          fz_keep_image(ctx, extent->loaded) : pdf_load_image(ctx, document, image);
+        ready               = true;
+      }
+    }
+  } fz_catch (ctx) {
+    ready = false;
+  }
+
+  return ready;
+}
+
+static void
+mupdf_downsample_compress(fz_pixmap* pixmap, mupdf_downsample_item_t* item)
+{
+  size_t row_size        = (size_t) pixmap->w * pixmap->n;
+  size_t samples_size    = row_size * pixmap->h;
+  unsigned char* samples = g_malloc(samples_size);
+
+  for (int y = 0; y < pixmap->h; y++) {
+    memcpy(samples + y * row_size, pixmap->samples + y * pixmap->stride, row_size);
+  }
+
+  uLongf size          = compressBound(samples_size);
+  unsigned char* bytes = g_malloc(size);
+
+  if (compress2(bytes, &size, samples, samples_size, Z_DEFAULT_COMPRESSION) == Z_OK &&
+      size < item->original_size) {
+    item->data          = bytes;
+    item->size          = size;
+    item->result_width  = pixmap->w;
+    item->result_height = pixmap->h;
+  } else {
+    g_free(bytes);
+  }
+
+  g_free(samples);
+}
+
+/* Runs on the pool's threads; decoding only reads the image's own copy of
+ * the stream, never the document */
+static void
+mupdf_downsample_item(gpointer data, gpointer user_data)
+{
+  mupdf_downsample_item_t* item   = data;
+  mupdf_downsample_batch_t* batch = user_data;
+
+  fz_context* ctx = fz_clone_context(batch->ctx);
+  if (ctx != NULL) {
+    fz_pixmap* pixmap = NULL;
+    fz_pixmap* scaled = NULL;
+
+    fz_var(pixmap);
+    fz_var(scaled);
+
+    fz_try (ctx) {
+      pixmap = fz_get_pixmap_from_image(ctx, item->decoder, NULL, NULL, 0, 0);
+      if (pixmap->alpha == 0 && pixmap->n == item->decoder->n) {
+        scaled = fz_scale_pixmap(ctx, pixmap, 0, 0, item->width, item->height, NULL);
+        if (scaled != NULL) {
+          mupdf_downsample_compress(scaled, item);
+        }
+      }
+    } fz_always (ctx) {
+      fz_drop_pixmap(ctx, scaled);
+      fz_drop_pixmap(ctx, pixmap);
+    } fz_catch (ctx) {
+      /* the image is kept */
+    }
+
+    fz_drop_context(ctx);
+  }
+
+  g_mutex_lock(&batch->mutex);
+  if (--batch->pending == 0) {
+    g_cond_signal(&batch->cond);
+  }
+  g_mutex_unlock(&batch->mutex);
+}
+
+static void
+mupdf_downsample_store(fz_context* ctx, pdf_document* document,
+    mupdf_downsample_item_t* item, GArray* originals)
+{
+  fz_buffer* buffer                    = NULL;
+  mupdf_downsample_original_t original = { .image = NULL };
+
+  fz_var(buffer);
+  fz_var(original);
+
+  fz_try (ctx) {
+    buffer = fz_new_buffer(ctx, item->size);
+    fz_append_data(ctx, buffer, item->data, item->size);
+
+    pdf_xref_entry* x = pdf_get_xref_entry(ctx, document, pdf_to_num(ctx, item->image));
+    original.dict     = pdf_copy_dict(ctx, pdf_resolve_indirect(ctx, item->image));
+    original.buffer   = fz_keep_buffer(ctx, x->stm_buf);
+    original.image    = pdf_keep_obj(ctx, item->image);
+
+    /* the array owns the original from here on */
+    g_array_append_val(originals, original);
+    original = (mupdf_downsample_original_t) { .image = NULL };
+
+    pdf_dict_put_drop(ctx, item->image, PDF_NAME_Width,
+        pdf_new_int(ctx, document, item->result_width));
+    pdf_dict_put_drop(ctx, item->image, PDF_NAME_Height,
+        pdf_new_int(ctx, document, item->result_height));
+    pdf_dict_put(ctx, item->image, PDF_NAME_Filter, PDF_NAME_FlateDecode);
+    pdf_dict_del(ctx, item->image, PDF_NAME_DecodeParms);
+    pdf_update_stream(ctx, document, item->image, buffer, 1);
+  } fz_always (ctx) {
+    fz_drop_buffer(ctx, buffer);
+  } fz_catch (ctx) {
+    /* the image is written as it was, or restored if it was changed */
+    pdf_drop_obj(ctx, original.image);
+    pdf_drop_obj(ctx, original.dict);
+    fz_drop_buffer(ctx, original.buffer);
+  }
+}
+
+static gint
+mupdf_downsample_compare(gconstpointer a, gconstpointer b)
+{
+  return GPOINTER_TO_INT(a) - GPOINTER_TO_INT(b);
+}
+
+GArray*
+mupdf_document_downsample_images(fz_context* ctx, pdf_document* document,
+    unsigned int dpi, fz_cookie* cookie)
+{
+  GHashTable* images = g_hash_table_new(g_direct_hash, g_direct_equal);
+  GHashTable* drawn  = g_hash_table_new(g_direct_hash, g_direct_equal);
+  GArray* originals  = g_array_new(FALSE, FALSE, sizeof(mupdf_downsample_original_t));
+
+  int n_pages = 0;
+
+  fz_var(n_pages);
+
+  fz_try (ctx) {
+    n_pages = pdf_count_pages(ctx, document);
+  } fz_catch (ctx) {
+    n_pages = 0;
+  }
+
+  for (int i = 0; i < n_pages; i++) {
+    mupdf_downsample_collect_page(ctx, document, i, images, drawn);
+  }
+
+  mupdf_downsample_batch_t batch = { .ctx = ctx, .pending = 0 };
+  g_mutex_init(&batch.mutex);
+  g_cond_init(&batch.cond);
+
+  unsigned int n_threads = g_get_num_processors();
+  GThreadPool* pool      = g_thread_pool_new(mupdf_downsample_item, &batch,
+      n_threads, FALSE, NULL);
+  GArray* items          = g_array_new(FALSE, TRUE, sizeof(mupdf_downsample_item_t));
+
+  /* images are rewritten in object order */
+  GList* numbers = g_list_sort(g_hash_table_get_keys(images), mupdf_downsample_compare);
+  GList* next    = numbers;
+
+  while (pool != NULL && next != NULL && (cookie == NULL || cookie->abort == 0)) {
+    g_array_set_size(items, 0);
+
+    for (; next != NULL && items->len < MUPDF_DOWNSAMPLE_BATCH_ITEMS * n_threads; next = next->next) {
+      mupdf_downsample_extent_t* extent = g_hash_table_lookup(images, next->data);
+      mupdf_downsample_item_t item      = { .image = NULL };
+
+      if (mupdf_downsample_prepare(ctx, document, extent, dpi, &item) == true) {
+        g_array_append_val(items, item);
+      }
+    }
+
+    batch.pending = items->len;
+    for (unsigned int i = 0; i < items->len; i++) {
+      g_thread_pool_push(pool, &g_array_index(items, mupdf_downsample_item_t, i), NULL);
+    }
+
+    g_mutex_lock(&batch.mutex);
+    while (batch.pending > 0) {
+      g_cond_wait(&batch.cond, &batch.mutex);
+    }
+    g_mutex_unlock(&batch.mutex);
+
+    for (unsigned int i = 0; i < items->len; i++) {
+      mupdf_downsample_item_t* item = &g_array_index(items, mupdf_downsample_item_t, i);
+      if (item->data != NULL) {
+        mupdf_downsample_store(ctx, document, item, originals);
+      }
+
+      fz_drop_image(ctx, item->decoder);
+      g_free(item->data);
+    }
+  }
+
+  if (pool != NULL) {
+    g_thread_pool_free(pool, FALSE, TRUE);
+  }
+  g_array_free(items, TRUE);
+  g_list_free(numbers);
+
+  GHashTableIter iter;
+  gpointer value = NULL;
+  g_hash_table_iter_init(&iter, images);
+  while (g_hash_table_iter_next(&iter, NULL, &value) == TRUE) {
+    mupdf_downsample_extent_t* extent = value;
+    fz_drop_image(ctx, extent->loaded);
+    pdf_drop_obj(ctx, extent->image);
+    g_free(extent);
+  }
+  g_hash_table_destroy(drawn);
+  g_hash_table_destroy(images);
+
+  g_cond_clear(&batch.cond);
+  g_mutex_clear(&batch.mutex);
+
+  return originals;
+}
+
+void
+mupdf_document_downsample_restore(fz_context* ctx, pdf_document* document,
+    GArray* originals)
+{
+  if (originals == NULL) {
+    return;
+  }
+
+  pdf_obj* keys[] = {
+    PDF_NAME_Width,
+    PDF_NAME_Height,
+    PDF_NAME_Filter,
+    PDF_NAME_DecodeParms,
+    PDF_NAME_Length
+  };
+
+  for (unsigned int i = 0; i < originals->len; i++) {
+    mupdf_downsample_original_t* original = &g_array_index(originals, mupdf_downsample_original_t, i);
+
+    /* a copy that is dropped next only has its originals freed */
+    if (document != NULL) {
+      fz_try (ctx) {
+        for (unsigned int k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+          pdf_obj* value = pdf_dict_get(ctx, original->dict, keys[k]);
+          if (value != NULL) {
+            pdf_dict_put(ctx, original->image, keys[k], value);
+          } else {
+            pdf_dict_del(ctx, original->image, keys[k]);
+          }
+        }
+
+        /* without a buffer the stream is read from the file again */
+        pdf_xref_entry* x = pdf_get_xref_entry(ctx, document, pdf_to_num(ctx, original->image));
+        fz_drop_buffer(ctx, x->stm_buf);
+        x->stm_buf       = original->buffer;
+        original->buffer = NULL;
+      } fz_catch (ctx) {
+      }
+    }
+
+    fz_drop_buffer(ctx, original->buffer);
+    pdf_drop_obj(ctx, original->dict);
+    pdf_drop_obj(ctx, original->image);
+  }
+
+  g_array_free(originals, TRUE);
+}
@@ -0,0 +1,49 @@
+/* See LICENSE file for license and copyright information */
+
+#ifndef DOWNSAMPLE_H
+#define DOWNSAMPLE_H
+
+#include <glib.h>
+#include <mupdf/pdf.h>
+
+#include "plugin.h"
+
+/** Images are only downsampled if their resolution exceeds the target by
+ * this factor, as smaller reductions save little and cost sharpness */
+#define MUPDF_DOWNSAMPLE_THRESHOLD 1.5
+
+/**
+ * Replaces the images of the document whose resolution is above dpi by
+ * flate compressed copies at dpi. The resolution of an image is measured
+ * where it is drawn largest, cropped and zoomed placements included; images
+ * that are never drawn through their XObject are kept. Only 8 bit
+ * gray, RGB, CMYK and ICC based images without masks or decode arrays are
+ * resampled, and only if the copy is smaller than the original stream.
+ * Images are decoded, scaled and compressed on one thread per processor.
+ * The document is changed, so a shared document needs its mutex held.
+ *
+ * @param ctx Context of the calling thread
+ * @param document The document
+ * @param dpi Target resolution
+ * @param cookie Cookie checked between batches to abort, or NULL
+ * @return The original images, to be passed to
+ *   mupdf_document_downsample_restore once the document has been written
+ */
+GArray* mupdf_document_downsample_images(fz_context* ctx, pdf_document* document,
+    unsigned int dpi, fz_cookie* cookie);
+
+/**
+ * Puts the original images back into the document, so that it keeps being
+ * displayed at full resolution after it has been saved. Has to be called
+ * with the document mutex held.
+ *
+ * @param ctx Context of the calling thread
+ * @param document The document, or NULL to only free originals when the
+ *   document is dropped anyway
+ * @param originals Result of mupdf_document_downsample_images (freed) or
+ *   NULL
+ */
+void mupdf_document_downsample_restore(fz_context* ctx, pdf_document* document,
+    GArray* originals);
+
+#endif // DOWNSAMPLE_H
@@ -0,0 +1,653 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "export.h"
+
+/* A word of a text line; its characters are stored in a shared string */
+typedef struct mupdf_export_word_s
+{
+  fz_rect bbox; /**< Union of the character boxes */
+  gsize offset; /**< Offset of the UTF-8 text in the line string */
+  gsize length; /**< Length of the UTF-8 text */
+} mupdf_export_word_t;
+
+/* State shared by the threads of a parallel export */
+typedef struct mupdf_export_job_s
+{
+  const char* path; /**< Path of the document */
+  const char* password; /**< Password or NULL */
+  mupdf_export_format_t format; /**< Output format */
+  int n_pages; /**< Number of pages */
+  GMutex mutex; /**< Protects the fields below */
+  GCond cond; /**< Signalled when a page is done or written */
+  int next_page; /**< Next page to extract */
+  int next_write; /**< Next page to write */
+  GBytes** results; /**< Extracted pages waiting to be written */
+  bool failed; /**< If a worker failed */
+} mupdf_export_job_t;
+
+fz_output*
+mupdf_export_open_fd(fz_context* ctx, int fd)
+{
+  int copy = dup(fd);
+  if (copy == -1) {
+    return NULL;
+  }
+
+  FILE* file = fdopen(copy, "wb");
+  if (file == NULL) {
+    close(copy);
+    return NULL;
+  }
+
+  fz_output* out = NULL;
+
+  fz_try (ctx) {
+    out = fz_new_output_with_file_ptr(ctx, file, 1);
+  } fz_catch (ctx) {
+    fclose(file);
+    out = NULL;
+  }
+
+  return out;
+}
+
+fz_stext_page*
+mupdf_export_extract_page(fz_context* ctx, fz_document* document,
+    GMutex* mutex, int index, fz_stext_sheet* sheet, fz_cookie* cookie)
+{
+  fz_page* page       = NULL;
+  fz_stext_page* text = NULL;
+  fz_device* device   = NULL;
+
+  fz_var(page);
+  fz_var(text);
+  fz_var(device);
+
+  if (mutex != NULL) {
+    g_mutex_lock(mutex);
+  }
+
+  fz_try (ctx) {
+    fz_rect mediabox;
+    page   = fz_load_page(ctx, document, index);
+    text   = fz_new_stext_page(ctx, fz_bound_page(ctx, page, &mediabox));
+    device = fz_new_stext_device(ctx, sheet, text, NULL);
+    fz_run_page(ctx, page, device, &fz_identity, cookie);
+    fz_close_device(ctx, device);
+  } fz_always (ctx) {
+    fz_drop_device(ctx, device);
+    fz_drop_page(ctx, page);
+    if (mutex != NULL) {
+      g_mutex_unlock(mutex);
+    }
+  } fz_catch (ctx) {
+    fz_drop_stext_page(ctx, text);
+    fz_rethrow(ctx);
+  }
+
+  return text;
+}
+
+/* Splits a line at white space. Words continue across spans, as spans only
+ * separate changes of style. */
+static void
+mupdf_export_line_words(fz_context* ctx, fz_stext_line* line, GArray* words,
+    GString* string)
+{
+  g_array_set_size(words, 0);
+  g_string_truncate(string, 0);
+
+  mupdf_export_word_t word = { .bbox = fz_empty_rect };
+  bool in_word             = false;
+
+  for (fz_stext_span* span = line->first_span; span != NULL; span = span->next) {
+    for (int i = 0; i < span->len; i++) {
+      int c = span->text[i].c;
+
+      if (g_unichar_isspace(c) == TRUE) {
+        if (in_word == true) {
+          word.length = string->len - word.offset;
+          g_array_append_val(words, word);
+          in_word = false;
+        }
+        continue;
+      }
+
+      if (in_word == false) {
+        word.bbox   = fz_empty_rect;
+        word.offset = string->len;
+        in_word     = true;
+      }
+
+      fz_rect bbox;
+      fz_stext_char_bbox(ctx, &bbox, span, i);
+      fz_union_rect(&word.bbox, &bbox);
+      g_string_append_unichar(string, c);
+    }
+  }
+
+  if (in_word == true) {
+    word.length = string->len - word.offset;
+    g_array_append_val(words, word);
+  }
+}
+
+static void
+mupdf_export_write_json_string(fz_context* ctx, fz_output* out,
+    const char* text, gsize length)
+{
+  fz_write_byte(ctx, out, '"');
+  for (gsize i = 0; i < length; i++) {
+    unsigned char c = text[i];
+    if (c == '"' || c == '\\') {
+      fz_write_byte(ctx, out, '\\');
+      fz_write_byte(ctx, out, c);
+    } else if (c < 0x20) {
+      fz_printf(ctx, out, "\\u%04x", c);
+    } else {
+      fz_write_byte(ctx, out, c);
+    }
+  }
+  fz_write_byte(ctx, out, '"');
+}
+
+static void
+mupdf_export_write_json_bbox(fz_context* ctx, fz_output* out, const fz_rect* bbox)
+{
+  fz_printf(ctx, out, "\"bbox\":[%g,%g,%g,%g]", bbox->x0, bbox->y0, bbox->x1, bbox->y1);
+}
+
+static void
+mupdf_export_write_json(fz_context* ctx, fz_output* out, int index,
+    fz_stext_page* text)
+{
+  GArray* words   = g_array_new(FALSE, FALSE, sizeof(mupdf_export_word_t));
+  GString* string = g_string_new(NULL);
+
+  fz_var(words);
+  fz_var(string);
+
+  fz_try (ctx) {
+    fz_printf(ctx, out, "{\"page\":%d,\"width\":%g,\"height\":%g,\"blocks\":[",
+        index, text->mediabox.x1 - text->mediabox.x0,
+        text->mediabox.y1 - text->mediabox.y0);
+
+    bool first_block = true;
+    for (int b = 0; b < text->len; b++) {
+      if (text->blocks[b].type != FZ_PAGE_BLOCK_TEXT) {
+        continue;
+      }
+
+      fz_stext_block* block = text->blocks[b].u.text;
+      fz_printf(ctx, out, "%s{", (first_block == true) ? "" : ",");
+      mupdf_export_write_json_bbox(ctx, out, &block->bbox);
+      fz_printf(ctx, out, ",\"lines\":[");
+      first_block = false;
+
+      for (int l = 0; l < block->len; l++) {
+        fz_stext_line* line = &block->lines[l];
+        mupdf_export_line_words(ctx, line, words, string);
+
+        fz_rect bbox = fz_empty_rect;
+        for (fz_stext_span* span = line->first_span; span != NULL; span = span->next) {
+          fz_union_rect(&bbox, &span->bbox);
+        }
+
+        fz_printf(ctx, out, "%s{", (l == 0) ? "" : ",");
+        mupdf_export_write_json_bbox(ctx, out, &bbox);
+        fz_printf(ctx, out, ",\"words\":[");
+
+        for (guint w = 0; w < words->len; w++) {
+          mupdf_export_word_t* word = &g_array_index(words, mupdf_export_word_t, w);
+          fz_printf(ctx, out, "%s{\"text\":", (w == 0) ? "" : ",");
+          mupdf_export_write_json_string(ctx, out, string->str + word->offset, word->length);
+          fz_write_byte(ctx, out, ',');
+          mupdf_export_write_json_bbox(ctx, out, &word->bbox);
+          fz_write_byte(ctx, out, '}');
+        }
+
+        fz_printf(ctx, out, "]}");
+      }
+
+      fz_printf(ctx, out, "]}");
+    }
+
+    fz_printf(ctx, out, "]}\n");
+  } fz_always (ctx) {
+    g_array_free(words, TRUE);
+    g_string_free(string, TRUE);
+  } fz_catch (ctx) {
+    fz_rethrow(ctx);
+  }
+}
+
+static void
+mupdf_export_write_u32(fz_context* ctx, fz_output* out, guint32 value)
+{
+  unsigned char data[4] = {
+    value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, (value >> 24) & 0xFF
+  };
+  fz_write(ctx, out, data, sizeof(data));
+}
+
+static void
+mupdf_export_write_f32(fz_context* ctx, fz_output* out, float value)
+{
+  guint32 bits;
+  memcpy(&bits, &value, sizeof(bits));
+  mupdf_export_write_u32(ctx, out, bits);
+}
+
+static void
+mupdf_export_write_binary_bbox(fz_context* ctx, fz_output* out, const fz_rect* bbox)
+{
+  mupdf_export_write_f32(ctx, out, bbox->x0);
+  mupdf_export_write_f32(ctx, out, bbox->y0);
+  mupdf_export_write_f32(ctx, out, bbox->x1);
+  mupdf_export_write_f32(ctx, out, bbox->y1);
+}
+
+static void
+mupdf_export_write_binary(fz_context* ctx, fz_output* out, int index,
+    fz_stext_page* text)
+{
+  GArray* words   = g_array_new(FALSE, FALSE, sizeof(mupdf_export_word_t));
+  GString* string = g_string_new(NULL);
+
+  fz_var(words);
+  fz_var(string);
+
+  fz_try (ctx) {
+    guint32 n_blocks = 0;
+    for (int b = 0; b < text->len; b++) {
+      if (text->blocks[b].type == FZ_PAGE_BLOCK_TEXT) {
+        n_blocks++;
+      }
+    }
+
+    fz_write(ctx, out, MUPDF_EXPORT_BINARY_MAGIC, 4);
+    mupdf_export_write_u32(ctx, out, index);
+    mupdf_export_write_f32(ctx, out, text->mediabox.x1 - text->mediabox.x0);
+    mupdf_export_write_f32(ctx, out, text->mediabox.y1 - text->mediabox.y0);
+    mupdf_export_write_u32(ctx, out, n_blocks);
+
+    for (int b = 0; b < text->len; b++) {
+      if (text->blocks[b].type != FZ_PAGE_BLOCK_TEXT) {
+        continue;
+      }
+
+      fz_stext_block* block = text->blocks[b].u.text;
+      mupdf_export_write_binary_bbox(ctx, out, &block->bbox);
+      mupdf_export_write_u32(ctx, out, block->len);
+
+      for (int l = 0; l < block->len; l++) {
+        fz_stext_line* line = &block->lines[l];
+        mupdf_export_line_words(ctx, line, words, string);
+
+        fz_rect bbox = fz_empty_rect;
+        for (fz_stext_span* span = line->first_span; span != NULL; span = span->next) {
+          fz_union_rect(&bbox, &span->bbox);
+        }
+
+        mupdf_export_write_binary_bbox(ctx, out, &bbox);
+        mupdf_export_write_u32(ctx, out, words->len);
+
+        for (guint w = 0; w < words->len; w++) {
+          mupdf_export_word_t* word = &g_array_index(words, mupdf_export_word_t, w);
+          mupdf_export_write_binary_bbox(ctx, out, &word->bbox);
+          mupdf_export_write_u32(ctx, out, word->length);
+          fz_write(ctx, out, string->str + word->offset, word->length);
+        }
+      }
+    }
+  } fz_always (ctx) {
+    g_array_free(words, TRUE);
+    g_string_free(string, TRUE);
+  } fz_catch (ctx) {
+    fz_rethrow(ctx);
+  }
+}
+
+static void
+mupdf_export_write_page(fz_context* ctx, fz_output* out, int index,
+    fz_stext_page* text, mupdf_export_format_t format)
+{
+  switch (format) {
+    case MUPDF_EXPORT_FORMAT_TEXT:
+      if (index > 0) {
+        fz_write_byte(ctx, out, '\f');
+      }
+      fz_print_stext_page(ctx, out, text);
+      break;
+    case MUPDF_EXPORT_FORMAT_JSON:
+      mupdf_export_write_json(ctx, out, index, text);
+      break;
+    case MUPDF_EXPORT_FORMAT_BINARY:
+      mupdf_export_write_binary(ctx, out, index, text);
+      break;
+  }
+}
+
+/* A page whose extraction has been aborted is not written */
+static void
+mupdf_export_page(fz_context* ctx, fz_document* document, GMutex* mutex,
+    fz_output* out, int index, mupdf_export_format_t format, fz_cookie* cookie)
+{
+  fz_stext_sheet* sheet = NULL;
+  fz_stext_page* text   = NULL;
+
+  fz_var(sheet);
+  fz_var(text);
+
+  fz_try (ctx) {
+    /* a fresh sheet per page keeps the style list from growing */
+    sheet = fz_new_stext_sheet(ctx);
+    text  = mupdf_export_extract_page(ctx, document, mutex, index, sheet, cookie);
+    if (cookie == NULL || cookie->abort == 0) {
+      mupdf_export_write_page(ctx, out, index, text, format);
+    }
+  } fz_always (ctx) {
+    fz_drop_stext_page(ctx, text);
+    fz_drop_stext_sheet(ctx, sheet);
+  } fz_catch (ctx) {
+    fz_rethrow(ctx);
+  }
+}
+
+zathura_error_t
+mupdf_export(fz_context* ctx, fz_document* document, GMutex* mutex,
+    fz_output* out, mupdf_export_format_t format, fz_cookie* cookie)
+{
+  if (ctx == NULL || document == NULL || out == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  fz_cookie local_cookie = { 0 };
+  if (cookie == NULL) {
+    cookie = &local_cookie;
+  }
+
+  zathura_error_t error = ZATHURA_ERROR_OK;
+
+  fz_var(error);
+
+  fz_try (ctx) {
+    int n_pages = fz_count_pages(ctx, document);
+    cookie->progress_max = n_pages;
+
+    /* the interpreter counts operators in the cookie, the progress is
+     * restored to pages after each page */
+    for (int i = 0; i < n_pages && cookie->abort == 0; i++) {
+      mupdf_export_page(ctx, document, mutex, out, i, format, cookie);
+      cookie->progress     = i + 1;
+      cookie->progress_max = n_pages;
+    }
+  } fz_catch (ctx) {
+    error = ZATHURA_ERROR_UNKNOWN;
+  }
+
+  return error;
+}
+
+fz_document*
+mupdf_export_open_document(fz_context* ctx, const char* path, const char* password)
+{
+  fz_document* document = NULL;
+
+  fz_var(document);
+
+  fz_try (ctx) {
+    fz_register_document_handlers(ctx);
+    document = fz_open_document(ctx, path);
+
+    if (fz_needs_password(ctx, document) != 0 && (password == NULL ||
+          fz_authenticate_password(ctx, document, (char*) password) == 0)) {
+      fz_throw(ctx, FZ_ERROR_GENERIC, "invalid password");
+    }
+  } fz_catch (ctx) {
+    fz_drop_document(ctx, document);
+    fz_rethrow(ctx);
+  }
+
+  return document;
+}
+
+/* Every worker has its own context and its own instance of the document, so
+ * pages are extracted without any shared state */
+static gpointer
+mupdf_export_worker(gpointer data)
+{
+  mupdf_export_job_t* job = data;
+  unsigned int window     = g_get_num_processors() * 4;
+  fz_context* ctx         = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+  fz_document* document   = NULL;
+
+  if (ctx == NULL) {
+    goto error_ret;
+  }
+
+  fz_var(document);
+
+  fz_try (ctx) {
+    document = mupdf_export_open_document(ctx, job->path, job->password);
+  } fz_catch (ctx) {
+    goto error_free;
+  }
+
+  while (true) {
+    g_mutex_lock(&job->mutex);
+    /* bound the number of pages waiting to be written */
+    while (job->failed == false && job->next_page < job->n_pages &&
+        job->next_page >= job->next_write + (int) window) {
+      g_cond_wait(&job->cond, &job->mutex);
+    }
+    if (job->failed == true || job->next_page >= job->n_pages) {
+      g_mutex_unlock(&job->mutex);
+      break;
+    }
+    int index = job->next_page++;
+    g_mutex_unlock(&job->mutex);
+
+    fz_buffer* buffer = NULL;
+    fz_output* out    = NULL;
+    GBytes* result    = NULL;
+
+    fz_var(buffer);
+    fz_var(out);
+    fz_var(result);
+
+    fz_try (ctx) {
+      buffer = fz_new_buffer(ctx, 4096);
+      out    = fz_new_output_with_buffer(ctx, buffer);
+      mupdf_export_page(ctx, document, NULL, out, index, job->format, NULL);
+      fz_drop_output(ctx, out);
+      out = NULL;
+
+      unsigned char* bytes = NULL;
+      size_t length        = fz_buffer_storage(ctx, buffer, &bytes);
+      result               = g_bytes_new(bytes, length);
+    } fz_always (ctx) {
+      fz_drop_output(ctx, out);
+      fz_drop_buffer(ctx, buffer);
+    } fz_catch (ctx) {
+      result = NULL;
+    }
+
+    g_mutex_lock(&job->mutex);
+    if (result == NULL) {
+      job->failed = true;
+    } else {
+      job->results[index] = result;
+    }
+    g_cond_broadcast(&job->cond);
+    g_mutex_unlock(&job->mutex);
+  }
+
+  fz_drop_document(ctx, document);
+  fz_drop_context(ctx);
+
+  return NULL;
+
+error_free:
+
+  fz_drop_context(ctx);
+
+error_ret:
+
+  g_mutex_lock(&job->mutex);
+  job->failed = true;
+  g_cond_broadcast(&job->cond);
+  g_mutex_unlock(&job->mutex);
+
+  return NULL;
+}
+
+zathura_error_t
+mupdf_export_file(fz_context* ctx, const char* path, const char* password,
+    fz_output* out, mupdf_export_format_t format, unsigned int n_threads)
+{
+  if (ctx == NULL || path == NULL || out == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  if (n_threads == 0) {
+    n_threads = g_get_num_processors();
+  }
+
+  fz_document* document = NULL;
+  zathura_error_t error = ZATHURA_ERROR_OK;
+
+  fz_var(document);
+  fz_var(error);
+
+  /* a single thread works on the document directly */
+  if (n_threads == 1) {
+    fz_try (ctx) {
+      document = mupdf_export_open_document(ctx, path, password);
+      error    = mupdf_export(ctx, document, NULL, out, format, NULL);
+    } fz_always (ctx) {
+      fz_drop_document(ctx, document);
+    } fz_catch (ctx) {
+      error = ZATHURA_ERROR_UNKNOWN;
+    }
+
+    return error;
+  }
+
+  mupdf_export_job_t job = {
+    .path     = path,
+    .password = password,
+    .format   = format
+  };
+
+  fz_try (ctx) {
+    document    = mupdf_export_open_document(ctx, path, password);
+    job.n_pages = fz_count_pages(ctx, document);
+  } fz_always (ctx) {
+    fz_drop_document(ctx, document);
+  } fz_catch (ctx) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  g_mutex_init(&job.mutex);
+  g_cond_init(&job.cond);
+  job.results = g_malloc0_n(MAX(job.n_pages, 1), sizeof(GBytes*));
+
+  GThread** threads = g_malloc0_n(n_threads, sizeof(GThread*));
+  for (unsigned int i = 0; i < n_threads; i++) {
+    threads[i] = g_thread_new("export", mupdf_export_worker, &job);
+  }
+
+  /* pages are written in order as soon as they are available */
+  for (int i = 0; i < job.n_pages; i++) {
+    g_mutex_lock(&job.mutex);
+    while (job.results[i] == NULL && job.failed == false) {
+      g_cond_wait(&job.cond, &job.mutex);
+    }
+    GBytes* result = job.results[i];
+    job.results[i] = NULL;
+    job.next_write = i + 1;
+    g_cond_broadcast(&job.cond);
+    g_mutex_unlock(&job.mutex);
+
+    if (result == NULL) {
+      error = ZATHURA_ERROR_UNKNOWN;
+      break;
+    }
+
+    fz_try (ctx) {
+      gsize length     = 0;
+      const void* data = g_bytes_get_data(result, &length);
+      fz_write(ctx, out, data, length);
+    } fz_catch (ctx) {
+      error = ZATHURA_ERROR_UNKNOWN;
+    }
+    g_bytes_unref(result);
+
+    if (error != ZATHURA_ERROR_OK) {
+      g_mutex_lock(&job.mutex);
+      job.failed = true;
+      g_cond_broadcast(&job.cond);
+      g_mutex_unlock(&job.mutex);
+      break;
+    }
+  }
+
+  for (unsigned int i = 0; i < n_threads; i++) {
+    g_thread_join(threads[i]);
+  }
+  g_free(threads);
+
+  for (int i = 0; i < job.n_pages; i++) {
+    if (job.results[i] != NULL) {
+      g_bytes_unref(job.results[i]);
+    }
+  }
+  g_free(job.results);
+  g_cond_clear(&job.cond);
+  g_mutex_clear(&job.mutex);
+
+  return error;
+}
+
+zathura_error_t
+pdf_document_export(mupdf_document_t* mupdf_document, int fd,
+    mupdf_export_format_t format, fz_cookie* cookie)
+{
+  if (mupdf_document == NULL || fd < 0) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  /* the export may run on any thread, so it gets its own context */
+  fz_context* ctx = fz_clone_context(mupdf_document->ctx);
+  if (ctx == NULL) {
+    return ZATHURA_ERROR_OUT_OF_MEMORY;
+  }
+
+  zathura_error_t error = ZATHURA_ERROR_UNKNOWN;
+
+  fz_output* out = mupdf_export_open_fd(ctx, fd);
+  if (out != NULL) {
+    error = mupdf_export(ctx, mupdf_document->document,
+        &mupdf_document->mutex, out, format, cookie);
+    fz_drop_output(ctx, out);
+  }
+
+  fz_drop_context(ctx);
+
+  return error;
+}
+
+zathura_error_t
+pdf_document_export_text(mupdf_document_t* mupdf_document, int fd,
+    fz_cookie* cookie)
+{
+  return pdf_document_export(mupdf_document, fd, MUPDF_EXPORT_FORMAT_TEXT, cookie);
+}
@@ -0,0 +1,84 @@
+/* See LICENSE file for license and copyright information */
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "plugin.h"
+
+/**
+ * Opens an output writing to a file descriptor. The descriptor is
+ * duplicated, so the caller keeps ownership of it.
+ *
+ * @param ctx Context
+ * @param fd File descriptor
+ * @return The output or NULL if the descriptor could not be used
+ */
+fz_output* mupdf_export_open_fd(fz_context* ctx, int fd);
+
+/**
+ * Opens a document file and authenticates with the password if needed
+ *
+ * @param ctx Context
+ * @param path Path of the document
+ * @param password Password or NULL
+ * @return The document, throws on errors
+ */
+fz_document* mupdf_export_open_document(fz_context* ctx, const char* path,
+    const char* password);
+
+/**
+ * Loads a page, extracts its text and drops the page again
+ *
+ * @param ctx Context of the calling thread
+ * @param document The document
+ * @param mutex Mutex serializing access to the document or NULL
+ * @param index Index of the page
+ * @param sheet Style sheet the text refers to
+ * @param cookie Cookie used to abort the extraction or NULL
+ * @return The text of the page, throws on errors
+ */
+fz_stext_page* mupdf_export_extract_page(fz_context* ctx, fz_document* document,
+    GMutex* mutex, int index, fz_stext_sheet* sheet, fz_cookie* cookie);
+
+/** Marks the start of a page record in MUPDF_EXPORT_FORMAT_BINARY */
+#define MUPDF_EXPORT_BINARY_MAGIC "ZPMT"
+
+/**
+ * Extracts the text of all pages in order and writes it to the output in the
+ * given format. The text of each page is dropped before the next one is
+ * loaded, so memory use does not grow with the document.
+ *
+ * @param ctx Context of the calling thread
+ * @param document The document
+ * @param mutex Mutex serializing access to the document or NULL
+ * @param out Output
+ * @param format Output format
+ * @param cookie Cookie reporting progress in pages and used to abort the
+ *   export, also in the middle of a page, or NULL
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t mupdf_export(fz_context* ctx, fz_document* document,
+    GMutex* mutex, fz_output* out, mupdf_export_format_t format,
+    fz_cookie* cookie);
+
+/**
+ * Exports a document file using several threads. Each thread opens its own
+ * instance of the document with its own context and extracts pages from a
+ * shared counter; the pages are written in order, with at most a few pages
+ * per processor waiting to be written.
+ *
+ * @param ctx Context used to write to the output
+ * @param path Path of the document
+ * @param password Password of the document or NULL
+ * @param out Output
+ * @param format Output format
+ * @param n_threads Number of threads, 0 to use one per processor
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t mupdf_export_file(fz_context* ctx, const char* path,
+    const char* password, fz_output* out, mupdf_export_format_t format,
+    unsigned int n_threads);
+
+#endif // EXPORT_H
@@ -28,6 +28,10 @@ pdf_page_images_get(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_erro
   }
 
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    goto error_free;
+  }
 
   /* Setup image list */
   list = girara_list_new();
@@ -41,7 +45,9 @@ pdf_page_images_get(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_erro
   girara_list_set_free_function(list, (girara_free_function_t) pdf_zathura_image_free);
 
   /* Extract images */
-  mupdf_page_extract_text(mupdf_document, mupdf_page);
+  mupdf_page_extract_text(ctx, mupdf_document, mupdf_page, NULL);
+
+  g_mutex_lock(&mupdf_document->mutex);
 
   fz_page_block* block;
   for (block = mupdf_page->text->blocks; block < mupdf_page->text->blocks + mupdf_page->text->len; block++) {
@@ -60,6 +66,8 @@ pdf_page_images_get(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_erro
     }
   }
 
+  g_mutex_unlock(&mupdf_document->mutex);
+
   return list;
 
 error_free:
@@ -88,12 +96,25 @@ pdf_page_image_get_cairo(zathura_page_t* page, mupdf_page_t* mupdf_page,
     goto error_ret;
   }
 
-  fz_image* mupdf_image = (fz_image*) image->data;
+  zathura_document_t* document = zathura_page_get_document(page);
+  if (document == NULL) {
+    goto error_ret;
+  }
+
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_image* mupdf_image            = (fz_image*) image->data;
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    goto error_ret;
+  }
 
   fz_pixmap* pixmap = NULL;
   cairo_surface_t* surface = NULL;
 
-  pixmap = fz_get_pixmap_from_image(mupdf_page->ctx, mupdf_image, NULL, NULL, 0, 0);
+  /* decoding reads the image stream from the document */
+  g_mutex_lock(&mupdf_document->mutex);
+  pixmap = fz_get_pixmap_from_image(ctx, mupdf_image, NULL, NULL, 0, 0);
+  g_mutex_unlock(&mupdf_document->mutex);
   if (pixmap == NULL) {
     goto error_free;
   }
@@ -106,11 +127,11 @@ pdf_page_image_get_cairo(zathura_page_t* page, mupdf_page_t* mupdf_page,
   unsigned char* surface_data = cairo_image_surface_get_data(surface);
   int rowstride = cairo_image_surface_get_stride(surface);
 
-  unsigned char* s = fz_pixmap_samples(mupdf_page->ctx, pixmap);
-  unsigned int n   = fz_pixmap_components(mupdf_page->ctx, pixmap);
+  unsigned char* s = fz_pixmap_samples(ctx, pixmap);
+  unsigned int n   = fz_pixmap_components(ctx, pixmap);
 
-  for (unsigned int y = 0; y < fz_pixmap_height(mupdf_page->ctx, pixmap); y++) {
-    for (unsigned int x = 0; x < fz_pixmap_width(mupdf_page->ctx, pixmap); x++) {
+  for (unsigned int y = 0; y < fz_pixmap_height(ctx, pixmap); y++) {
+    for (unsigned int x = 0; x < fz_pixmap_width(ctx, pixmap); x++) {
       guchar* p = surface_data + y * rowstride + x * 4;
 
       // RGB
@@ -128,14 +149,14 @@ pdf_page_image_get_cairo(zathura_page_t* page, mupdf_page_t* mupdf_page,
     }
   }
 
-  fz_drop_pixmap(mupdf_page->ctx, pixmap);
+  fz_drop_pixmap(ctx, pixmap);
 
   return surface;
 
 error_free:
 
   if (pixmap != NULL) {
-    fz_drop_pixmap(mupdf_page->ctx, pixmap);
+    fz_drop_pixmap(ctx, pixmap);
   }
 
   if (surface != NULL) {
@@ -5,6 +5,7 @@
 #include <girara/datastructures.h>
 
 #include "plugin.h"
+#include "utils.h"
 
 static void build_index(fz_context* ctx, fz_document* document, fz_outline*
     outline, girara_tree_node_t* root);
@@ -19,9 +20,20 @@ pdf_document_index_generate(zathura_document_t* document, mupdf_document_t* mupd
     return NULL;
   }
 
-  /* get outline */
-  fz_outline* outline = fz_load_outline(mupdf_document->ctx, mupdf_document->document);
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_UNKNOWN;
+    }
+    return NULL;
+  }
+
+  /* get outline; workers may use the document at the same time */
+  g_mutex_lock(&mupdf_document->mutex);
+
+  fz_outline* outline = fz_load_outline(ctx, mupdf_document->document);
   if (outline == NULL) {
+    g_mutex_unlock(&mupdf_document->mutex);
     if (error != NULL) {
       *error = ZATHURA_ERROR_UNKNOWN;
     }
@@ -30,10 +42,12 @@ pdf_document_index_generate(zathura_document_t* document, mupdf_document_t* mupd
 
   /* generate index */
   girara_tree_node_t* root = girara_node_new(zathura_index_element_new("ROOT"));
-  build_index(mupdf_document->ctx, mupdf_document->document, outline, root);
+  build_index(ctx, mupdf_document->document, outline, root);
 
   /* free outline */
-  fz_drop_outline(mupdf_document->ctx, outline);
+  fz_drop_outline(ctx, outline);
+
+  g_mutex_unlock(&mupdf_document->mutex);
 
   return root;
 }
@@ -0,0 +1,195 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <string.h>
+#include <glib.h>
+
+#include "layer.h"
+#include "dedup.h"
+#include "utils.h"
+
+/* Rasters hold BGRA pixels as written by the draw device */
+#define MUPDF_LAYER_PIXEL_SIZE 4
+
+struct mupdf_layer_raster_s
+{
+  unsigned char* data; /**< Pixels */
+  unsigned int width; /**< Width in pixels */
+  unsigned int height; /**< Height in pixels */
+  int rowstride; /**< Rowstride */
+  double scalex; /**< Horizontal scale */
+  double scaley; /**< Vertical scale */
+  gint ref_count; /**< Pages and shared entries holding the raster */
+};
+
+static mupdf_layer_raster_t*
+mupdf_layer_raster_ref(mupdf_layer_raster_t* raster)
+{
+  g_atomic_int_inc(&raster->ref_count);
+
+  return raster;
+}
+
+void
+mupdf_layer_raster_unref(mupdf_layer_raster_t* raster)
+{
+  if (raster == NULL || g_atomic_int_dec_and_test(&raster->ref_count) == FALSE) {
+    return;
+  }
+
+  g_free(raster->data);
+  g_free(raster);
+}
+
+static bool
+mupdf_layer_raster_matches(const mupdf_layer_raster_t* raster, int rowstride,
+    unsigned int width, unsigned int height, double scalex, double scaley)
+{
+  return raster != NULL && raster->width == width && raster->height == height &&
+    raster->rowstride == rowstride && raster->scalex == scalex &&
+    raster->scaley == scaley;
+}
+
+/* Has to be called with the document mutex held */
+static void
+mupdf_layer_set_raster(mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, mupdf_layer_raster_t* raster)
+{
+  mupdf_layer_raster_unref(mupdf_page->content_raster);
+  mupdf_page->content_raster = raster;
+
+  g_queue_remove(&mupdf_document->layer_pages, mupdf_page);
+  g_queue_push_head(&mupdf_document->layer_pages, mupdf_page);
+
+  while (g_queue_get_length(&mupdf_document->layer_pages) > MUPDF_LAYER_MAX_PAGES) {
+    mupdf_page_t* oldest = g_queue_pop_tail(&mupdf_document->layer_pages);
+    mupdf_layer_raster_unref(oldest->content_raster);
+    oldest->content_raster = NULL;
+  }
+}
+
+bool
+mupdf_layer_copy_contents(mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, unsigned char* image, int rowstride,
+    unsigned int width, unsigned int height, double scalex, double scaley,
+    const fz_irect* region, fz_cookie* cookie)
+{
+  if (mupdf_document == NULL || mupdf_page == NULL || image == NULL) {
+    return false;
+  }
+
+  if (mupdf_document_lock_abortable(mupdf_document, cookie) == false) {
+    return false;
+  }
+
+  /* identical pages with other annotations share their content layer */
+  mupdf_layer_raster_t* raster = mupdf_page->content_raster;
+  if (mupdf_layer_raster_matches(raster, rowstride, width, height, scalex,
+        scaley) == false) {
+    raster = NULL;
+    if (mupdf_page->shared != NULL && mupdf_layer_raster_matches(
+          mupdf_page->shared->content_raster, rowstride, width, height,
+          scalex, scaley) == true) {
+      raster = mupdf_page->shared->content_raster;
+      mupdf_layer_set_raster(mupdf_document, mupdf_page, mupdf_layer_raster_ref(raster));
+    }
+  }
+
+  /* the pixels never change, so they are copied without the lock */
+  if (raster != NULL) {
+    mupdf_layer_raster_ref(raster);
+  }
+
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  if (raster == NULL) {
+    return false;
+  }
+
+  if (region == NULL) {
+    memcpy(image, raster->data, (gsize) rowstride * height);
+  } else {
+    gsize offset = region->x0 * MUPDF_LAYER_PIXEL_SIZE;
+    gsize length = (region->x1 - region->x0) * MUPDF_LAYER_PIXEL_SIZE;
+    for (int y = region->y0; y < region->y1; y++) {
+      memcpy(image + y * rowstride + offset,
+          raster->data + y * rowstride + offset, length);
+    }
+  }
+
+  mupdf_layer_raster_unref(raster);
+
+  return true;
+}
+
+void
+mupdf_layer_store_contents(mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, const unsigned char* image, int rowstride,
+    unsigned int width, unsigned int height, double scalex, double scaley,
+    unsigned int generation, fz_cookie* cookie)
+{
+  if (mupdf_document == NULL || mupdf_page == NULL || image == NULL ||
+      generation != mupdf_document_raster_generation(mupdf_document)) {
+    return;
+  }
+
+  mupdf_layer_raster_t* raster = g_malloc0(sizeof(mupdf_layer_raster_t));
+  raster->data      = g_memdup(image, (guint) rowstride * height);
+  raster->width     = width;
+  raster->height    = height;
+  raster->rowstride = rowstride;
+  raster->scalex    = scalex;
+  raster->scaley    = scaley;
+  raster->ref_count = 1;
+
+  if (mupdf_document_lock_abortable(mupdf_document, cookie) == false) {
+    mupdf_layer_raster_unref(raster);
+    return;
+  }
+
+  /* the rasters may have been dropped while copying */
+  if (generation != mupdf_document->raster_generation) {
+    g_mutex_unlock(&mupdf_document->mutex);
+    mupdf_layer_raster_unref(raster);
+    return;
+  }
+
+  mupdf_layer_set_raster(mupdf_document, mupdf_page, raster);
+
+  /* only worth sharing if another page can use it */
+  mupdf_shared_page_t* shared = mupdf_page->shared;
+  if (shared != NULL && shared->ref_count > 1) {
+    mupdf_layer_raster_unref(shared->content_raster);
+    shared->content_raster = mupdf_layer_raster_ref(raster);
+  }
+
+  g_mutex_unlock(&mupdf_document->mutex);
+}
+
+void
+mupdf_layer_clear(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page)
+{
+  if (mupdf_document == NULL || mupdf_page == NULL) {
+    return;
+  }
+
+  g_mutex_lock(&mupdf_document->mutex);
+
+  g_queue_remove(&mupdf_document->layer_pages, mupdf_page);
+  mupdf_layer_raster_unref(mupdf_page->content_raster);
+  mupdf_page->content_raster = NULL;
+
+  g_mutex_unlock(&mupdf_document->mutex);
+}
+
+void
+mupdf_layer_clear_all(mupdf_document_t* mupdf_document)
+{
+  mupdf_page_t* mupdf_page = NULL;
+
+  while ((mupdf_page = g_queue_pop_head(&mupdf_document->layer_pages)) != NULL) {
+    mupdf_layer_raster_unref(mupdf_page->content_raster);
+    mupdf_page->content_raster = NULL;
+  }
+}
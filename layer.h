@@ -0,0 +1,80 @@
+/* See LICENSE file for license and copyright information */
+
+#ifndef LAYER_H
+#define LAYER_H
+
+#include "plugin.h"
+
+/** Maximum number of pages keeping a raster of their content layer */
+#define MUPDF_LAYER_MAX_PAGES 8
+
+/**
+ * Copies the cached raster of the page's content layer (without
+ * annotations) if it was rendered with the same parameters. The raster of
+ * an identical page is used as well.
+ *
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ * @param image Target buffer
+ * @param rowstride Rowstride of the target buffer
+ * @param width Width of the target buffer
+ * @param height Height of the target buffer
+ * @param scalex Horizontal scale
+ * @param scaley Vertical scale
+ * @param region Area to copy in device space or NULL for the whole page
+ * @param cookie Cookie of the render or NULL; nothing is copied if it is
+ *   aborted while waiting for the document mutex
+ * @return true if the raster has been copied, otherwise false
+ */
+bool mupdf_layer_copy_contents(mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, unsigned char* image, int rowstride,
+    unsigned int width, unsigned int height, double scalex, double scaley,
+    const fz_irect* region, fz_cookie* cookie);
+
+/**
+ * Keeps a copy of the page's content layer raster so that changed
+ * annotations can be drawn on top without rendering the contents again. The
+ * copy is shared with identical pages instead of being copied for each.
+ *
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ * @param image Rendered buffer
+ * @param rowstride Rowstride of the buffer
+ * @param width Width of the buffer
+ * @param height Height of the buffer
+ * @param scalex Horizontal scale
+ * @param scaley Vertical scale
+ * @param generation Raster generation the render started in, see
+ *   mupdf_document_raster_generation
+ * @param cookie Cookie of the render or NULL; nothing is kept if it is
+ *   aborted while waiting for the document mutex
+ */
+void mupdf_layer_store_contents(mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, const unsigned char* image, int rowstride,
+    unsigned int width, unsigned int height, double scalex, double scaley,
+    unsigned int generation, fz_cookie* cookie);
+
+/**
+ * Drops the content layer raster of the page
+ *
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ */
+void mupdf_layer_clear(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page);
+
+/**
+ * Drops the content layer rasters of all pages. Has to be called with the
+ * document mutex held.
+ *
+ * @param mupdf_document Document
+ */
+void mupdf_layer_clear_all(mupdf_document_t* mupdf_document);
+
+/**
+ * Releases a reference to a content layer raster
+ *
+ * @param raster The raster or NULL
+ */
+void mupdf_layer_raster_unref(mupdf_layer_raster_t* raster);
+
+#endif // LAYER_H
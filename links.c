@@ -5,6 +5,7 @@
 #include <glib.h>
 
 #include "plugin.h"
+#include "utils.h"
 
 girara_list_t*
 pdf_page_links_get(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_error_t* error)
@@ -21,7 +22,11 @@ pdf_page_links_get(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_error
     goto error_ret;
   }
 
-  mupdf_document_t* mupdf_document = zathura_document_get_data(document);;
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    goto error_ret;
+  }
 
   girara_list_t* list = girara_list_new2((girara_free_function_t) zathura_link_free);
   if (list == NULL) {
@@ -31,7 +36,10 @@ pdf_page_links_get(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_error
     goto error_free;
   }
 
-  fz_link* link = fz_load_links(mupdf_document->ctx, mupdf_page->page);
+  /* links are resolved against the document, which workers use as well */
+  g_mutex_lock(&mupdf_document->mutex);
+
+  fz_link* link = fz_load_links(ctx, mupdf_page->page);
   for (; link != NULL; link = link->next) {
     /* extract position */
     zathura_rectangle_t position;
@@ -43,7 +51,7 @@ pdf_page_links_get(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_error
     zathura_link_type_t type     = ZATHURA_LINK_INVALID;
     zathura_link_target_t target = { 0 };
 
-    if (fz_is_external_link(mupdf_document->ctx, link->uri) == 1) {
+    if (fz_is_external_link(ctx, link->uri) == 1) {
       if (strstr(link->uri, "file://") == link->uri) {
         type         = ZATHURA_LINK_GOTO_REMOTE;
         target.value = link->uri;
@@ -57,7 +65,7 @@ pdf_page_links_get(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_error
 
       type                    = ZATHURA_LINK_GOTO_DEST;
       target.destination_type = ZATHURA_LINK_DESTINATION_XYZ;
-      target.page_number      = fz_resolve_link(mupdf_document->ctx,
+      target.page_number      = fz_resolve_link(ctx,
           mupdf_document->document, link->uri, &x, &y);
       target.left  = x;
       target.top   = y;
@@ -70,6 +78,8 @@ pdf_page_links_get(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_error
     }
   }
 
+  g_mutex_unlock(&mupdf_document->mutex);
+
   return list;
 
 error_free:
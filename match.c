@@ -0,0 +1,382 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include "match.h"
+
+/* A character of the page text in reading order */
+typedef struct mupdf_match_char_s
+{
+  gunichar c; /**< Canonical form of the character */
+  fz_stext_span* span; /**< Span of the character, NULL for line breaks */
+  int index; /**< Index of the character in the span */
+  unsigned int line; /**< Running number of the line */
+} mupdf_match_char_t;
+
+static gunichar
+mupdf_match_canon(gunichar c)
+{
+  if (g_unichar_isspace(c) == TRUE) {
+    return ' ';
+  }
+
+  return g_unichar_tolower(c);
+}
+
+/* Lines are joined with a space, so hits may continue on the next line */
+static void
+mupdf_match_flatten(fz_stext_page* text, GArray* chars)
+{
+  unsigned int line_number = 0;
+
+  for (int b = 0; b < text->len; b++) {
+    if (text->blocks[b].type != FZ_PAGE_BLOCK_TEXT) {
+      continue;
+    }
+
+    fz_stext_block* block = text->blocks[b].u.text;
+    for (int l = 0; l < block->len; l++, line_number++) {
+      fz_stext_line* line = &block->lines[l];
+
+      for (fz_stext_span* span = line->first_span; span != NULL; span = span->next) {
+        for (int i = 0; i < span->len; i++) {
+          mupdf_match_char_t ch = {
+            .c     = mupdf_match_canon(span->text[i].c),
+            .span  = span,
+            .index = i,
+            .line  = line_number
+          };
+          g_array_append_val(chars, ch);
+        }
+      }
+
+      mupdf_match_char_t line_break = { .c = ' ', .line = line_number };
+      g_array_append_val(chars, line_break);
+    }
+  }
+}
+
+/* Same geometry as fz_stext_char_bbox, but keeps the corners */
+static void
+mupdf_match_char_quad(fz_stext_span* span, int index, mupdf_quad_t* quad)
+{
+  fz_stext_char* ch   = &span->text[index];
+  const fz_point* end = (index == span->len - 1) ? &span->max : &span->text[index + 1].p;
+
+  fz_point ascender  = { 0, 0 };
+  fz_point descender = { 0, 0 };
+  if (span->wmode == 0) {
+    ascender.y  = span->ascender_max;
+    descender.y = span->descender_min;
+  } else {
+    ascender.x  = span->ascender_max;
+    descender.x = span->descender_min;
+  }
+  fz_transform_vector(&ascender, &span->transform);
+  fz_transform_vector(&descender, &span->transform);
+
+  quad->ul.x = ch->p.x + ascender.x;
+  quad->ul.y = ch->p.y + ascender.y;
+  quad->ur.x = end->x + ascender.x;
+  quad->ur.y = end->y + ascender.y;
+  quad->ll.x = ch->p.x + descender.x;
+  quad->ll.y = ch->p.y + descender.y;
+  quad->lr.x = end->x + descender.x;
+  quad->lr.y = end->y + descender.y;
+}
+
+/* Same test as fz_copy_selection: the hitbox of the character overlaps the
+ * rectangle */
+static bool
+mupdf_match_char_selected(fz_context* ctx, fz_stext_span* span, int index,
+    const fz_rect* rect)
+{
+  fz_rect bbox;
+  fz_stext_char_bbox(ctx, &bbox, span, index);
+
+  return bbox.x1 >= rect->x0 && bbox.x0 <= rect->x1 &&
+    bbox.y1 >= rect->y0 && bbox.y0 <= rect->y1;
+}
+
+/* Appends one quad per line the characters [start, end) lie on */
+static void
+mupdf_match_add_quads(const mupdf_match_char_t* chars, unsigned int start,
+    unsigned int end, unsigned int hit, GArray* quads)
+{
+  mupdf_quad_t quad;
+  unsigned int line = 0;
+  bool open         = false;
+
+  for (unsigned int i = start; i < end; i++) {
+    const mupdf_match_char_t* ch = &chars[i];
+    if (ch->span == NULL) {
+      continue;
+    }
+
+    mupdf_quad_t char_quad;
+    mupdf_match_char_quad(ch->span, ch->index, &char_quad);
+
+    if (open == true && ch->line == line) {
+      quad.ur = char_quad.ur;
+      quad.lr = char_quad.lr;
+      continue;
+    }
+
+    if (open == true) {
+      g_array_append_val(quads, quad);
+    }
+
+    quad     = char_quad;
+    quad.hit = hit;
+    line     = ch->line;
+    open     = true;
+  }
+
+  if (open == true) {
+    g_array_append_val(quads, quad);
+  }
+}
+
+/* Returns the number of characters matching the needle at start, 0 if it
+ * does not match there */
+static unsigned int
+mupdf_match_at(const mupdf_match_char_t* chars, unsigned int n_chars,
+    const gunichar* needle, unsigned int start)
+{
+  unsigned int n = start;
+
+  while (*needle != 0) {
+    if (n >= n_chars || chars[n].c != *needle) {
+      return 0;
+    }
+
+    if (*needle == ' ') {
+      while (*needle == ' ') {
+        needle++;
+      }
+      while (n < n_chars && chars[n].c == ' ') {
+        n++;
+      }
+    } else {
+      needle++;
+      n++;
+    }
+  }
+
+  return n - start;
+}
+
+unsigned int
+mupdf_search_stext_quads(fz_context* GIRARA_UNUSED(ctx), fz_stext_page* text,
+    const char* needle, GArray* quads, fz_cookie* cookie)
+{
+  g_array_set_size(quads, 0);
+
+  glong length      = 0;
+  gunichar* pattern = g_utf8_to_ucs4(needle, -1, NULL, &length, NULL);
+  if (pattern == NULL || length == 0) {
+    g_free(pattern);
+    return 0;
+  }
+
+  /* a blank pattern would match every space without covering a character */
+  bool blank = true;
+  for (glong i = 0; i < length; i++) {
+    pattern[i] = mupdf_match_canon(pattern[i]);
+    if (pattern[i] != ' ') {
+      blank = false;
+    }
+  }
+
+  if (blank == true) {
+    g_free(pattern);
+    return 0;
+  }
+
+  GArray* chars       = g_array_new(FALSE, FALSE, sizeof(mupdf_match_char_t));
+  unsigned int n_hits = 0;
+
+  mupdf_match_flatten(text, chars);
+
+  const mupdf_match_char_t* data = (const mupdf_match_char_t*) chars->data;
+  for (unsigned int i = 0; i < chars->len;) {
+    if (data[i].span == NULL && cookie != NULL && cookie->abort != 0) {
+      g_array_set_size(quads, 0);
+      n_hits = 0;
+      break;
+    }
+
+    unsigned int n = mupdf_match_at(data, chars->len, pattern, i);
+    if (n == 0) {
+      i++;
+      continue;
+    }
+
+    mupdf_match_add_quads(data, i, i + n, n_hits++, quads);
+    i += n;
+  }
+
+  g_array_free(chars, TRUE);
+  g_free(pattern);
+
+  return n_hits;
+}
+
+unsigned int
+mupdf_search_stext_page(fz_context* ctx, fz_stext_page* text,
+    const char* needle, GArray* hits, fz_cookie* cookie)
+{
+  GArray* quads = g_array_new(FALSE, FALSE, sizeof(mupdf_quad_t));
+
+  mupdf_search_stext_quads(ctx, text, needle, quads, cookie);
+
+  g_array_set_size(hits, quads->len);
+  for (unsigned int i = 0; i < quads->len; i++) {
+    mupdf_quad_t* quad = &g_array_index(quads, mupdf_quad_t, i);
+    fz_rect* hit       = &g_array_index(hits, fz_rect, i);
+
+    hit->x0 = hit->x1 = quad->ul.x;
+    hit->y0 = hit->y1 = quad->ul.y;
+    fz_include_point_in_rect(hit, &quad->ur);
+    fz_include_point_in_rect(hit, &quad->ll);
+    fz_include_point_in_rect(hit, &quad->lr);
+  }
+
+  g_array_free(quads, TRUE);
+
+  return hits->len;
+}
+
+void
+mupdf_select_stext_quads(fz_context* ctx, fz_stext_page* text,
+    const fz_rect* rect, GArray* quads)
+{
+  g_array_set_size(quads, 0);
+
+  for (int b = 0; b < text->len; b++) {
+    if (text->blocks[b].type != FZ_PAGE_BLOCK_TEXT) {
+      continue;
+    }
+
+    fz_stext_block* block = text->blocks[b].u.text;
+    for (int l = 0; l < block->len; l++) {
+      fz_stext_line* line = &block->lines[l];
+      mupdf_quad_t quad;
+      bool open = false;
+
+      for (fz_stext_span* span = line->first_span; span != NULL; span = span->next) {
+        for (int i = 0; i < span->len; i++) {
+          /* unselected characters end the fragment */
+          if (mupdf_match_char_selected(ctx, span, i, rect) == false) {
+            if (open == true) {
+              g_array_append_val(quads, quad);
+              open = false;
+            }
+            continue;
+          }
+
+          mupdf_quad_t char_quad;
+          mupdf_match_char_quad(span, i, &char_quad);
+
+          if (open == true) {
+            quad.ur = char_quad.ur;
+            quad.lr = char_quad.lr;
+          } else {
+            quad     = char_quad;
+            quad.hit = 0;
+            open     = true;
+          }
+        }
+      }
+
+      if (open == true) {
+        g_array_append_val(quads, quad);
+      }
+    }
+  }
+}
+
+void
+mupdf_copy_stext_selections(fz_context* ctx, fz_stext_page* text,
+    const fz_rect* rects, GString** texts, unsigned int n_rects)
+{
+  fz_rect area = fz_empty_rect;
+  for (unsigned int r = 0; r < n_rects; r++) {
+    fz_union_rect(&area, &rects[r]);
+  }
+
+  unsigned int* candidates = g_new(unsigned int, n_rects);
+  bool* line_seen          = g_new0(bool, n_rects);
+  bool* pending_newline    = g_new0(bool, n_rects);
+
+  for (int b = 0; b < text->len; b++) {
+    if (text->blocks[b].type != FZ_PAGE_BLOCK_TEXT) {
+      continue;
+    }
+
+    fz_stext_block* block = text->blocks[b].u.text;
+    fz_rect block_bbox    = block->bbox;
+    if (fz_is_empty_rect(fz_intersect_rect(&block_bbox, &area))) {
+      continue;
+    }
+
+    for (int l = 0; l < block->len; l++) {
+      fz_stext_line* line = &block->lines[l];
+
+      fz_rect line_bbox = fz_empty_rect;
+      for (fz_stext_span* span = line->first_span; span != NULL; span = span->next) {
+        fz_union_rect(&line_bbox, &span->bbox);
+      }
+
+      /* only the selections touching the line are tested per character */
+      unsigned int n_candidates = 0;
+      for (unsigned int r = 0; r < n_rects; r++) {
+        fz_rect bbox = line_bbox;
+        if (fz_is_empty_rect(fz_intersect_rect(&bbox, &rects[r])) == 0) {
+          candidates[n_candidates++] = r;
+        }
+      }
+
+      if (n_candidates == 0) {
+        continue;
+      }
+
+      for (fz_stext_span* span = line->first_span; span != NULL; span = span->next) {
+        for (int i = 0; i < span->len; i++) {
+          /* control characters are replaced like fz_copy_selection does */
+          int ch = span->text[i].c;
+          if (ch < 32) {
+            ch = '?';
+          }
+
+          for (unsigned int c = 0; c < n_candidates; c++) {
+            unsigned int r = candidates[c];
+            if (mupdf_match_char_selected(ctx, span, i, &rects[r]) == false) {
+              continue;
+            }
+
+            if (pending_newline[r] == true) {
+              g_string_append_c(texts[r], '\n');
+              pending_newline[r] = false;
+            }
+            g_string_append_unichar(texts[r], ch);
+            line_seen[r] = true;
+          }
+        }
+      }
+
+      /* lines are separated, but the text does not end with a newline */
+      for (unsigned int c = 0; c < n_candidates; c++) {
+        unsigned int r = candidates[c];
+        if (line_seen[r] == true) {
+          pending_newline[r] = true;
+          line_seen[r]       = false;
+        }
+      }
+    }
+  }
+
+  g_free(pending_newline);
+  g_free(line_seen);
+  g_free(candidates);
+}
@@ -0,0 +1,70 @@
+/* See LICENSE file for license and copyright information */
+
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <glib.h>
+
+#include "plugin.h"
+
+/**
+ * Searches the extracted text of a page. Matching ignores case and treats
+ * any run of white space, including line breaks, as a single space. Empty
+ * and blank needles match nothing.
+ *
+ * @param ctx Context of the calling thread
+ * @param text Extracted text of the page
+ * @param needle The text to search for
+ * @param quads Array of mupdf_quad_t the hits are stored in, one quad per
+ *   line a hit spans; it is cleared first
+ * @param cookie Cookie checked after every line to abort the search, or NULL
+ * @return The number of hits, 0 if the search was aborted
+ */
+unsigned int mupdf_search_stext_quads(fz_context* ctx, fz_stext_page* text,
+    const char* needle, GArray* quads, fz_cookie* cookie);
+
+/**
+ * Searches the extracted text of a page like mupdf_search_stext_quads but
+ * stores the bounding box of each quad. The number of hits is not limited.
+ *
+ * @param ctx Context of the calling thread
+ * @param text Extracted text of the page
+ * @param needle The text to search for
+ * @param hits Array of fz_rect the bboxes of the hits are stored in; it is
+ *   cleared first
+ * @param cookie Cookie checked after every line to abort the search, or NULL
+ * @return The number of bboxes
+ */
+unsigned int mupdf_search_stext_page(fz_context* ctx, fz_stext_page* text,
+    const char* needle, GArray* hits, fz_cookie* cookie);
+
+/**
+ * Collects the characters whose hitbox overlaps a rectangle, the same ones
+ * fz_copy_selection copies, as one quad per line fragment
+ *
+ * @param ctx Context of the calling thread
+ * @param text Extracted text of the page
+ * @param rect The selected rectangle in page space
+ * @param quads Array of mupdf_quad_t the quads are stored in; it is cleared
+ *   first
+ */
+void mupdf_select_stext_quads(fz_context* ctx, fz_stext_page* text,
+    const fz_rect* rect, GArray* quads);
+
+/**
+ * Copies the text of several selections on the same page in one pass over
+ * its characters. Lines outside of all selections are skipped as a whole.
+ * Like fz_copy_selection, a character is selected if its hitbox overlaps
+ * the rectangle, control characters are copied as '?' and selected lines
+ * are separated by newlines.
+ *
+ * @param ctx Context of the calling thread
+ * @param text Extracted text of the page
+ * @param rects The selected rectangles in page space
+ * @param texts One string per rectangle the selected text is appended to
+ * @param n_rects Number of rectangles
+ */
+void mupdf_copy_stext_selections(fz_context* ctx, fz_stext_page* text,
+    const fz_rect* rects, GString** texts, unsigned int n_rects);
+
+#endif // MATCH_H
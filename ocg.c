@@ -0,0 +1,174 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <glib.h>
+#include <mupdf/pdf.h>
+
+#include "plugin.h"
+#include "utils.h"
+#include "xobject.h"
+
+/* Builds the key of the current layer visibility. Has to be called with the
+ * document mutex held. */
+static const char*
+mupdf_layer_state(fz_context* ctx, pdf_document* document)
+{
+  int count       = pdf_count_layer_config_ui(ctx, document);
+  GString* string = g_string_sized_new(count + 1);
+
+  for (int i = 0; i < count; i++) {
+    pdf_layer_config_ui info;
+    pdf_layer_config_ui_info(ctx, document, i, &info);
+    g_string_append_c(string, (info.selected != 0) ? '1' : '0');
+  }
+
+  const char* state = g_intern_string(string->str);
+  g_string_free(string, TRUE);
+
+  return state;
+}
+
+unsigned int
+pdf_document_get_layer_count(mupdf_document_t* mupdf_document)
+{
+  if (mupdf_document == NULL) {
+    return 0;
+  }
+
+  fz_context* ctx        = mupdf_document_get_context(mupdf_document);
+  pdf_document* document = (ctx != NULL) ? pdf_specifics(ctx, mupdf_document->document) : NULL;
+  if (document == NULL) {
+    return 0;
+  }
+
+  int count = 0;
+
+  fz_var(count);
+
+  g_mutex_lock(&mupdf_document->mutex);
+  fz_try (ctx) {
+    count = pdf_count_layer_config_ui(ctx, document);
+  } fz_catch (ctx) {
+    count = 0;
+  }
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  return count;
+}
+
+zathura_error_t
+pdf_document_get_layer(mupdf_document_t* mupdf_document, unsigned int index,
+    const char** name, unsigned int* depth, bool* visible)
+{
+  if (mupdf_document == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  fz_context* ctx        = mupdf_document_get_context(mupdf_document);
+  pdf_document* document = (ctx != NULL) ? pdf_specifics(ctx, mupdf_document->document) : NULL;
+  if (document == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  zathura_error_t error = ZATHURA_ERROR_OK;
+
+  fz_var(error);
+
+  g_mutex_lock(&mupdf_document->mutex);
+  fz_try (ctx) {
+    if (index >= (unsigned int) pdf_count_layer_config_ui(ctx, document)) {
+      error = ZATHURA_ERROR_INVALID_ARGUMENTS;
+    } else {
+      pdf_layer_config_ui info;
+      pdf_layer_config_ui_info(ctx, document, index, &info);
+
+      if (name != NULL) {
+        *name = info.text;
+      }
+      if (depth != NULL) {
+        *depth = info.depth;
+      }
+      if (visible != NULL) {
+        *visible = (info.selected != 0);
+      }
+    }
+  } fz_catch (ctx) {
+    error = ZATHURA_ERROR_UNKNOWN;
+  }
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  return error;
+}
+
+zathura_error_t
+pdf_document_set_layer_visible(mupdf_document_t* mupdf_document,
+    unsigned int index, bool visible)
+{
+  if (mupdf_document == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  fz_context* ctx        = mupdf_document_get_context(mupdf_document);
+  pdf_document* document = (ctx != NULL) ? pdf_specifics(ctx, mupdf_document->document) : NULL;
+  if (document == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  zathura_error_t error = ZATHURA_ERROR_OK;
+  bool changed          = false;
+
+  fz_var(error);
+  fz_var(changed);
+
+  g_mutex_lock(&mupdf_document->mutex);
+  fz_try (ctx) {
+    if (index >= (unsigned int) pdf_count_layer_config_ui(ctx, document)) {
+      error = ZATHURA_ERROR_INVALID_ARGUMENTS;
+    } else {
+      if (visible == true) {
+        pdf_select_layer_config_ui(ctx, document, index);
+      } else {
+        pdf_deselect_layer_config_ui(ctx, document, index);
+      }
+
+      /* radio buttons and locked entries may leave the state as it was */
+      const char* state = mupdf_layer_state(ctx, document);
+      changed = (state != mupdf_document->layer_state);
+      mupdf_document->layer_state = state;
+    }
+  } fz_catch (ctx) {
+    error = ZATHURA_ERROR_UNKNOWN;
+  }
+
+  /* recorded forms only contain the groups that were visible */
+  if (changed == true) {
+    mupdf_form_cache_reset(ctx, mupdf_document);
+  }
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  if (changed == true) {
+    mupdf_document_drop_rasters(mupdf_document);
+  }
+
+  return error;
+}
+
+zathura_error_t
+pdf_document_set_annotations_visible(mupdf_document_t* mupdf_document, bool visible)
+{
+  if (mupdf_document == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  g_mutex_lock(&mupdf_document->mutex);
+  bool changed = (mupdf_document->hide_annotations == visible);
+  mupdf_document->hide_annotations = !visible;
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  if (changed == true) {
+    mupdf_document_drop_rasters(mupdf_document);
+  }
+
+  return ZATHURA_ERROR_OK;
+}
@@ -3,6 +3,12 @@
 #define _POSIX_C_SOURCE 1
 
 #include "plugin.h"
+#include "dedup.h"
+#include "layer.h"
+#include "pyramid.h"
+#include "registry.h"
+#include "scheduler.h"
+#include "utils.h"
 
 zathura_error_t
 pdf_page_init(zathura_page_t* page)
@@ -22,37 +28,43 @@ pdf_page_init(zathura_page_t* page)
 
   zathura_page_set_data(page, mupdf_page);
 
-  mupdf_page->ctx = mupdf_document->ctx;
-  if (mupdf_page->ctx == NULL) {
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
     goto error_free;
   }
 
-  /* load page */
-  fz_try (mupdf_page->ctx) {
-    mupdf_page->page = fz_load_page(mupdf_document->ctx, mupdf_document->document, index);
-  } fz_catch (mupdf_page->ctx) {
+  /* load page; workers may use the document at the same time */
+  g_mutex_lock(&mupdf_document->mutex);
+
+  fz_try (ctx) {
+    mupdf_page->page = fz_load_page(ctx, mupdf_document->document, index);
+    fz_bound_page(ctx, (fz_page*) mupdf_page->page, &mupdf_page->bbox);
+
+    /* setup text */
+    mupdf_page->extracted_text = false;
+    mupdf_page->text           = fz_new_stext_page(ctx, &mupdf_page->bbox);
+    mupdf_page->sheet          = fz_new_stext_sheet(ctx);
+  } fz_always (ctx) {
+    g_mutex_unlock(&mupdf_document->mutex);
+  } fz_catch (ctx) {
     goto error_free;
   }
 
-  fz_bound_page(mupdf_document->ctx, (fz_page*) mupdf_page->page, &mupdf_page->bbox);
-
   /* get page dimensions */
   zathura_page_set_width(page,  mupdf_page->bbox.x1 - mupdf_page->bbox.x0);
   zathura_page_set_height(page, mupdf_page->bbox.y1 - mupdf_page->bbox.y0);
 
-  /* setup text */
-  mupdf_page->extracted_text = false;
+  /* start recording pages which were slow before right away; the job is
+   * queued only once the page has been loaded completely */
+  bool slow = mupdf_registry_is_slow(mupdf_document->registry, index);
 
-  fz_rect mediabox;
-  mupdf_page->text = fz_new_stext_page(mupdf_page->ctx,
-      fz_bound_page(mupdf_page->ctx, mupdf_page->page, &mediabox));
-  if (mupdf_page->text == NULL) {
-    goto error_free;
-  }
+  g_mutex_lock(&mupdf_document->mutex);
+  mupdf_page->index = index;
+  mupdf_page->slow  = slow;
+  g_mutex_unlock(&mupdf_document->mutex);
 
-  mupdf_page->sheet = fz_new_stext_sheet(mupdf_page->ctx);
-  if (mupdf_page->sheet == NULL) {
-    goto error_free;
+  if (slow == true) {
+    mupdf_scheduler_push(mupdf_document->scheduler, MUPDF_JOB_PREFETCH, page, NULL, NULL);
   }
 
   return ZATHURA_ERROR_OK;
@@ -74,17 +86,39 @@ pdf_page_clear(zathura_page_t* page, mupdf_page_t* mupdf_page)
   zathura_document_t* document     = zathura_page_get_document(page);
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
 
+  fz_context* ctx = (mupdf_document != NULL) ? mupdf_document_get_context(mupdf_document) : NULL;
+
   if (mupdf_page != NULL) {
-    if (mupdf_page->text != NULL) {
-      fz_drop_stext_page(mupdf_page->ctx, mupdf_page->text);
-    }
+    /* without a context the page's objects cannot be dropped */
+    if (ctx != NULL) {
+      mupdf_scheduler_cancel_page(mupdf_document->scheduler, zathura_page_get_index(page));
+      mupdf_pyramid_clear(mupdf_document, mupdf_page);
+      mupdf_layer_clear(mupdf_document, mupdf_page);
 
-    if (mupdf_page->sheet != NULL) {
-      fz_drop_stext_sheet(mupdf_page->ctx, mupdf_page->sheet);
-    }
+      g_mutex_lock(&mupdf_document->mutex);
+      mupdf_page_release_shared(ctx, mupdf_document, mupdf_page);
+
+      if (mupdf_page->display_list != NULL) {
+        fz_drop_display_list(ctx, mupdf_page->display_list);
+      }
+
+      if (mupdf_page->annotation_list != NULL) {
+        fz_drop_display_list(ctx, mupdf_page->annotation_list);
+      }
+
+      if (mupdf_page->text != NULL) {
+        fz_drop_stext_page(ctx, mupdf_page->text);
+      }
+
+      if (mupdf_page->sheet != NULL) {
+        fz_drop_stext_sheet(ctx, mupdf_page->sheet);
+      }
+
+      if (mupdf_page->page != NULL) {
+        fz_drop_page(ctx, mupdf_page->page);
+      }
 
-    if (mupdf_page->page != NULL) {
-      fz_drop_page(mupdf_document->ctx, mupdf_page->page);
+      g_mutex_unlock(&mupdf_document->mutex);
     }
 
     free(mupdf_page);
@@ -4,6 +4,7 @@
 #define PDF_H
 
 #include <stdbool.h>
+#include <glib.h>
 #include <zathura/plugin-api.h>
 #include <mupdf/fitz.h>
 
@@ -11,20 +12,151 @@
 #include <cairo.h>
 #endif
 
+typedef struct mupdf_scheduler_s mupdf_scheduler_t;
+typedef struct mupdf_deadline_s mupdf_deadline_t;
+typedef struct mupdf_registry_s mupdf_registry_t;
+typedef struct mupdf_shared_page_s mupdf_shared_page_t;
+typedef struct mupdf_pyramid_s mupdf_pyramid_t;
+typedef struct mupdf_layer_raster_s mupdf_layer_raster_t;
+typedef struct mupdf_stream_cache_s mupdf_stream_cache_t;
+
+/**
+ * Formats of the document text export
+ */
+typedef enum mupdf_export_format_e
+{
+  MUPDF_EXPORT_FORMAT_TEXT, /**< UTF-8 text, pages separated by form feeds */
+  MUPDF_EXPORT_FORMAT_JSON, /**< One JSON object per page and line with
+                              blocks, lines and words and their bboxes */
+  MUPDF_EXPORT_FORMAT_BINARY /**< The same structure as little endian
+                               records, see pdf_document_export */
+} mupdf_export_format_t;
+
+/**
+ * Quadrilateral covering the part of a search hit or selection that lies on
+ * one line, in page space. Unlike a bounding box it follows rotated text.
+ */
+typedef struct mupdf_quad_s
+{
+  fz_point ul; /**< Ascender side of the first character */
+  fz_point ur; /**< Ascender side of the last character */
+  fz_point ll; /**< Descender side of the first character */
+  fz_point lr; /**< Descender side of the last character */
+  unsigned int hit; /**< Index of the hit the quad belongs to, 0 for selections */
+} mupdf_quad_t;
+
+/**
+ * One selection of a batch text request, see pdf_document_get_text_batch
+ */
+typedef struct mupdf_text_request_s
+{
+  unsigned int page; /**< Index of the page */
+  zathura_rectangle_t rectangle; /**< Selected area in page space */
+  char* text; /**< Set to the selected text (free with g_free) */
+} mupdf_text_request_t;
+
+/**
+ * Called from a worker thread by pdf_document_search_text after each page
+ * that has been searched, and once more with hits NULL when the search has
+ * ended
+ *
+ * @param page Index of the page, or the number of searched pages at the end
+ * @param n_pages Number of pages of the document
+ * @param hits List of mupdf_quad_t found on the page (owned by the callee,
+ *   free with girara_list_free), NULL at the end of the search
+ * @param data Custom data
+ */
+typedef void (*mupdf_search_callback_t)(unsigned int page, unsigned int n_pages,
+    girara_list_t* hits, void* data);
+
+/**
+ * Options of pdf_document_save_as_async
+ */
+typedef struct mupdf_save_options_s
+{
+  bool compress; /**< Deflate streams without filter, on all processors */
+  bool optimize; /**< Drop unused objects, merge identical objects and
+                   streams and linearize the file for fast opening. This
+                   runs on a copy, an encrypted copy is written as it is */
+  unsigned int image_dpi; /**< Resample images above this resolution to it,
+                            0 to keep them */
+} mupdf_save_options_t;
+
+/**
+ * Called from the save thread once a background save has finished
+ *
+ * @param path Path the document has been saved to
+ * @param error ZATHURA_ERROR_OK if the document has been saved or the save
+ *   has been aborted, otherwise see zathura_error_t
+ * @param data Custom data
+ */
+typedef void (*mupdf_save_callback_t)(const char* path, zathura_error_t error,
+    void* data);
+
+/**
+ * Called from a worker thread once a page that missed the render deadline
+ * has been rendered completely
+ *
+ * @param page The page
+ * @param image_buffer The complete image (owned by the callee, free with
+ *   zathura_image_buffer_free)
+ * @param data Custom data
+ */
+typedef void (*mupdf_render_callback_t)(zathura_page_t* page,
+    zathura_image_buffer_t* image_buffer, void* data);
+
 typedef struct mupdf_document_s
 {
   fz_context* ctx; /**< Context */
   fz_document* document; /**< mupdf document */
+  fz_locks_context locks; /**< Locking functions passed to mupdf */
+  GMutex lock_mutexes[FZ_LOCK_MAX]; /**< Mutexes backing the mupdf locks */
+  GMutex mutex; /**< Serializes access to the document and its pages */
+  GMutex context_mutex; /**< Protects thread_contexts */
+  GHashTable* thread_contexts; /**< Clones of ctx by the host thread using them */
+  mupdf_scheduler_t* scheduler; /**< Background job scheduler */
+  mupdf_deadline_t* deadline; /**< Watchdog enforcing the render deadline */
+  unsigned int render_deadline; /**< Render time budget in ms, 0 if disabled */
+  mupdf_render_callback_t render_callback; /**< Called for pages finished in the background */
+  void* render_callback_data; /**< Custom data passed to render_callback */
+  mupdf_registry_t* registry; /**< Render costs of slow pages */
+  GHashTable* shared_pages; /**< Results of identical pages by content digest */
+  GHashTable* form_cache; /**< Display lists of Form XObjects */
+  GQueue pyramid_pages; /**< Pages with a pyramid, most recently used first */
+  gsize pyramid_size; /**< Number of bytes held by the pyramids */
+  GQueue layer_pages; /**< Pages with a content layer raster, most recently used first */
+  volatile guint raster_generation; /**< Incremented atomically whenever all rasters are dropped */
+  const char* layer_state; /**< Interned key of the visible optional content groups */
+  bool hide_annotations; /**< If annotations are left out when rendering */
+  double device_scalex; /**< Horizontal device pixels per logical pixel */
+  double device_scaley; /**< Vertical device pixels per logical pixel */
+  mupdf_stream_cache_t* stream_cache; /**< Decrypted streams, NULL if not encrypted */
+  GThread* save_thread; /**< Thread of the last background save or NULL */
+  char* password; /**< Password the document was opened with, to reopen saved copies */
 } mupdf_document_t;
 
 typedef struct mupdf_page_s
 {
   fz_page* page; /**< Reference to the mupdf page */
-  fz_context* ctx; /**< Context */
   fz_stext_sheet* sheet; /**< Text sheet */
   fz_stext_page* text; /**< Page text */
   fz_rect bbox; /**< Bbox */
   bool extracted_text; /**< If text has already been extracted */
+  fz_display_list* display_list; /**< Cached display list of the page contents */
+  const char* display_list_state; /**< Layer state display_list was recorded in */
+  fz_display_list* annotation_list; /**< Cached display list of the annotations */
+  bool annotation_list_valid; /**< If annotation_list is up to date */
+  const char* annotation_list_state; /**< Layer state annotation_list was recorded in */
+  mupdf_layer_raster_t* content_raster; /**< Raster of the contents without annotations */
+  fz_rect dirty; /**< Area changed since the last render, in page space */
+  bool render_incomplete; /**< If the last render stopped at the deadline */
+  unsigned int index; /**< Index of the page */
+  bool slow; /**< If the page is known to be slow to render */
+  gint64 record_time; /**< Time spent recording the display list (us), reset once reported */
+  unsigned int complexity; /**< Number of operators in the display list */
+  bool hashed; /**< If the content digest has been computed */
+  mupdf_shared_page_t* shared; /**< Results shared with identical pages */
+  mupdf_pyramid_t* pyramid; /**< Raster pyramid of the largest render */
 } mupdf_page_t;
 
 /**
@@ -44,7 +176,10 @@ zathura_error_t pdf_document_open(zathura_document_t* document);
 zathura_error_t pdf_document_free(zathura_document_t* document, mupdf_document_t* mupdf_document);
 
 /**
- * Saves the document to the given path
+ * Saves the document to the given path. The document is written to a
+ * temporary file that replaces path once it is complete. Symbolic links are
+ * followed; hard-linked files and files whose owner cannot be kept are
+ * overwritten in place with the complete document.
  *
  * @param document Zathura document
  * @param path File path
@@ -54,6 +189,32 @@ zathura_error_t pdf_document_free(zathura_document_t* document, mupdf_document_t
 zathura_error_t pdf_document_save_as(zathura_document_t* document,
     mupdf_document_t* mupdf_document, const char* path);
 
+/**
+ * Saves the document to the given path on a background thread and returns
+ * immediately. The document mutex is held while the document is written as
+ * it is, so the file is a consistent snapshot; renders, searches and other
+ * requests that take the mutex wait for that write. Resampling images,
+ * compressing streams and optimizing run afterwards on a reopened copy and
+ * block nothing. Path is replaced like by pdf_document_save_as. A save
+ * started while another one is running is written after it, without
+ * blocking the caller.
+ *
+ * @param mupdf_document Document
+ * @param path File path
+ * @param options Save options or NULL for the defaults
+ * @param cookie Cookie reporting the progress (see MUPDF_SAVE_STEPS) and
+ *   used to abort the save before path is replaced, or NULL. It has to stay
+ *   valid until callback has been called.
+ * @param callback Called from the save thread when the save has finished,
+ *   or NULL
+ * @param data Custom data passed to callback
+ * @return ZATHURA_ERROR_OK if the save has been started, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t pdf_document_save_as_async(mupdf_document_t* mupdf_document,
+    const char* path, const mupdf_save_options_t* options, fz_cookie* cookie,
+    mupdf_save_callback_t callback, void* data);
+
 /**
  * Generates the index of the document
  *
@@ -93,6 +254,45 @@ zathura_error_t pdf_page_clear(zathura_page_t* page, mupdf_page_t* mupdf_page);
  */
 girara_list_t* pdf_page_search_text(zathura_page_t* page, mupdf_page_t* mupdf_page, const char* text, zathura_error_t* error);
 
+/**
+ * Searches for a specific text on a page and returns one quad per line a hit
+ * spans, so hits continuing on the next line or on rotated text are covered
+ * exactly
+ *
+ * @param page Page
+ * @param text Search item
+ * @param cookie Cookie used to abort text extraction and matching, or NULL.
+ *   An aborted search returns an empty list.
+ * @param error Set to an error value (see zathura_error_t) if an
+ *   error occurred
+ * @return List of mupdf_quad_t or NULL if an error occurred
+ */
+girara_list_t* pdf_page_search_text_quads(zathura_page_t* page,
+    mupdf_page_t* mupdf_page, const char* text, fz_cookie* cookie,
+    zathura_error_t* error);
+
+/**
+ * Searches all pages of the document in order and reports the hits of each
+ * page as soon as it has been searched. The search runs as a background job
+ * with its own context and the function returns right away; setting
+ * cookie->abort stops it within the current page, during text extraction or
+ * matching. Closing the document also stops it.
+ *
+ * @param document Zathura document
+ * @param text Search item
+ * @param cookie Cookie used to abort the search, or NULL. Its progress and
+ *   progress_max fields count the searched pages. It has to stay valid until
+ *   callback has been called with NULL hits.
+ * @param callback Called with the hits of every completely searched page
+ *   and once more with NULL hits when the search has ended
+ * @param data Custom data passed to callback
+ * @return ZATHURA_ERROR_OK when the search has been started, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t pdf_document_search_text(zathura_document_t* document,
+    mupdf_document_t* mupdf_document, const char* text, fz_cookie* cookie,
+    mupdf_search_callback_t callback, void* data);
+
 /**
  * Returns a list of internal/external links that are shown on the given page
  *
@@ -103,6 +303,44 @@ girara_list_t* pdf_page_search_text(zathura_page_t* page, mupdf_page_t* mupdf_pa
  */
 girara_list_t* pdf_page_links_get(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_error_t* error);
 
+/**
+ * Writes the text of the whole document to a file descriptor as UTF-8, pages
+ * separated by form feeds. Pages are extracted in order and their text is
+ * freed right away, independent of the text cached for displayed pages, so
+ * memory use stays constant for documents of any size.
+ *
+ * @param mupdf_document Document
+ * @param fd File descriptor (not closed)
+ * @param cookie Cookie reporting the number of exported pages and used to
+ *   abort the export, also in the middle of a page, or NULL
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t pdf_document_export_text(mupdf_document_t* mupdf_document,
+    int fd, fz_cookie* cookie);
+
+/**
+ * Writes the text of the whole document with its layout to a file
+ * descriptor. Coordinates are in the same page space as search results and
+ * selections. Like pdf_document_export_text, pages are processed one at a
+ * time in constant memory.
+ *
+ * MUPDF_EXPORT_FORMAT_BINARY writes one record per page: the magic "ZPMT",
+ * u32 page index, f32 width, f32 height, u32 number of blocks; per block
+ * its bbox (4 x f32) and u32 number of lines; per line its bbox and u32
+ * number of words; per word its bbox, u32 length and the UTF-8 text.
+ *
+ * @param mupdf_document Document
+ * @param fd File descriptor (not closed)
+ * @param format Output format
+ * @param cookie Cookie reporting the number of exported pages and used to
+ *   abort the export, also in the middle of a page, or NULL
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t pdf_document_export(mupdf_document_t* mupdf_document,
+    int fd, mupdf_export_format_t format, fz_cookie* cookie);
+
 /**
  * Returns a list of images included on the zathura page
  *
@@ -137,6 +375,36 @@ cairo_surface_t* pdf_page_image_get_cairo(zathura_page_t* page, mupdf_page_t*
  */
 char* pdf_page_get_text(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_rectangle_t rectangle, zathura_error_t* error);
 
+/**
+ * Get the text of many selections, possibly on many pages, in one call. The
+ * requests are grouped by page and each page's text is walked only once for
+ * all of its selections.
+ *
+ * @param document Zathura document
+ * @param requests The selections; the text field of each is set to the
+ *   selected text, an empty string for selections without text
+ * @param n_requests Number of requests
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t pdf_document_get_text_batch(zathura_document_t* document,
+    mupdf_document_t* mupdf_document, mupdf_text_request_t* requests,
+    unsigned int n_requests);
+
+/**
+ * Get the area of a selection as one quad per selected line fragment. The
+ * characters are the ones pdf_page_get_text returns for the same rectangle.
+ *
+ * @param page Page
+ * @param rectangle Selection
+ * @param error Set to an error value (see \ref zathura_error_t) if an error
+ * occurred
+ * @return List of mupdf_quad_t or NULL if an error occurred
+ */
+girara_list_t* pdf_page_get_selection_quads(zathura_page_t* page,
+    mupdf_page_t* mupdf_page, zathura_rectangle_t rectangle,
+    zathura_error_t* error);
+
 /**
  * Returns a list of document information entries of the document
  *
@@ -159,6 +427,187 @@ girara_list_t* pdf_document_get_information(zathura_document_t* document,
  */
 zathura_image_buffer_t* pdf_page_render(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_error_t* error);
 
+/**
+ * Renders a page at the given scales and returns a allocated image buffer
+ * which has to be freed with zathura_image_buffer_free. Like for
+ * pdf_page_render, the buffer size is truncated to whole pixels; the page is
+ * stretched to fill it exactly, so hosts can ask for device pixel resolution
+ * directly.
+ *
+ * @param page Page
+ * @param scalex Horizontal scale in device pixels per point
+ * @param scaley Vertical scale in device pixels per point
+ * @param error Set to an error value (see zathura_error_t) if an
+ *   error occurred
+ * @return Image buffer or NULL if an error occurred
+ */
+zathura_image_buffer_t* pdf_page_render_scaled(zathura_page_t* page,
+    mupdf_page_t* mupdf_page, double scalex, double scaley, zathura_error_t* error);
+
+/**
+ * Tells the plugin that the zoom level changed and which pages are visible
+ * now. The glyphs of the visible and neighbouring pages are rendered into
+ * MuPDF's glyph cache at the new scale by idle worker threads, so that
+ * text-heavy pages render at full speed right after zooming.
+ *
+ * @param document Zathura document
+ * @param mupdf_document Document
+ * @param first_page Index of the first visible page
+ * @param last_page Index of the last visible page
+ */
+void pdf_document_scale_changed(zathura_document_t* document,
+    mupdf_document_t* mupdf_document, unsigned int first_page,
+    unsigned int last_page);
+
+/**
+ * Tells the plugin which pages are visible, e.g. after scrolling. Background
+ * jobs run in order of their distance to these pages, and jobs for pages
+ * far away from them are aborted.
+ *
+ * @param mupdf_document Document
+ * @param first_page Index of the first visible page
+ * @param last_page Index of the last visible page
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t pdf_document_set_viewport(mupdf_document_t* mupdf_document,
+    unsigned int first_page, unsigned int last_page);
+
+/**
+ * Returns the number of background jobs that have been queued but not
+ * started yet, e.g. to show that pages are still being prepared
+ *
+ * @param mupdf_document Document
+ * @return Number of pending jobs
+ */
+unsigned int pdf_document_get_pending_jobs(mupdf_document_t* mupdf_document);
+
+/**
+ * Sets the scale factor between logical and device pixels of the display
+ * the document is shown on, e.g. 1.5 or 2 on HiDPI screens. pdf_page_render
+ * multiplies the document scale with it and rasterizes at device
+ * resolution, so the host does not need to resample the result.
+ *
+ * @param mupdf_document Document
+ * @param x Horizontal device scale
+ * @param y Vertical device scale
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t pdf_document_set_device_scale(mupdf_document_t* mupdf_document,
+    double x, double y);
+
+/**
+ * Returns a thumbnail of the page fitting into the given size. The page's
+ * embedded thumbnail is used if it is large enough, otherwise the page is
+ * rendered with reduced quality.
+ *
+ * @param page Page
+ * @param width Maximal width of the thumbnail
+ * @param height Maximal height of the thumbnail
+ * @param error Set to an error value (see zathura_error_t) if an
+ *   error occurred
+ * @return Image buffer or NULL if an error occurred
+ */
+zathura_image_buffer_t* pdf_page_get_thumbnail(zathura_page_t* page,
+    mupdf_page_t* mupdf_page, unsigned int width, unsigned int height,
+    zathura_error_t* error);
+
+/**
+ * Limits the time pdf_page_render and pdf_page_render_cairo may spend on a
+ * page. Pages exceeding the budget are returned partially drawn and are
+ * finished in the background. This includes the time spent waiting for a
+ * worker which is using the document, a page may come back blank then.
+ *
+ * @param mupdf_document The document
+ * @param milliseconds Time budget, 0 disables the deadline
+ * @param callback Called with the complete image once a page has been
+ *   finished in the background or NULL
+ * @param data Custom data passed to the callback
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t pdf_document_set_render_deadline(mupdf_document_t* mupdf_document,
+    unsigned int milliseconds, mupdf_render_callback_t callback, void* data);
+
+/**
+ * Checks whether the last render of the page stopped at the deadline
+ *
+ * @param mupdf_page Page
+ * @return true if the last rendered image is incomplete, otherwise false
+ */
+bool pdf_page_render_is_incomplete(mupdf_page_t* mupdf_page);
+
+/**
+ * Notifies the plugin that annotations or form fields of the page have been
+ * modified. Only the annotation layer is recorded and drawn again by the
+ * next render, the page contents are reused.
+ *
+ * @param page Page
+ * @param mupdf_page Mupdf page
+ */
+void pdf_page_annotations_changed(zathura_page_t* page, mupdf_page_t* mupdf_page);
+
+/**
+ * Notifies the plugin that a single annotation or form field of the page has
+ * been modified. Its bbox is added to the page's dirty area, which is redrawn
+ * by pdf_page_render_dirty_cairo. If the annotation is moved or resized, call
+ * this before and after the change so both areas are covered.
+ *
+ * @param page Page
+ * @param mupdf_page Mupdf page
+ * @param annot The modified annotation
+ */
+void pdf_page_annotation_changed(zathura_page_t* page, mupdf_page_t* mupdf_page, fz_annot* annot);
+
+/**
+ * Returns the number of entries in the optional content (layer) list of the
+ * document's default configuration
+ *
+ * @param mupdf_document Document
+ * @return Number of layers, 0 if the document has none
+ */
+unsigned int pdf_document_get_layer_count(mupdf_document_t* mupdf_document);
+
+/**
+ * Returns information about an entry of the layer list
+ *
+ * @param mupdf_document Document
+ * @param index Index of the entry
+ * @param name Set to the label of the entry (owned by the document) or NULL
+ * @param depth Set to the nesting depth of the entry or NULL
+ * @param visible Set to the visibility of the entry or NULL
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t pdf_document_get_layer(mupdf_document_t* mupdf_document,
+    unsigned int index, const char** name, unsigned int* depth, bool* visible);
+
+/**
+ * Shows or hides a layer. Hidden layers are skipped while recording display
+ * lists, which are cached per layer state, so rendering a single layer of a
+ * large drawing only costs as much as that layer.
+ *
+ * @param mupdf_document Document
+ * @param index Index of the entry
+ * @param visible If the layer should be drawn
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t pdf_document_set_layer_visible(mupdf_document_t* mupdf_document,
+    unsigned int index, bool visible);
+
+/**
+ * Enables or disables drawing of annotations and form fields
+ *
+ * @param mupdf_document Document
+ * @param visible If annotations should be drawn
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t pdf_document_set_annotations_visible(mupdf_document_t* mupdf_document,
+    bool visible);
+
 #if HAVE_CAIRO
 /**
  * Renders a page onto a cairo object
@@ -168,6 +617,30 @@ zathura_image_buffer_t* pdf_page_render(zathura_page_t* page, mupdf_page_t* mupd
  * @return  true if no error occurred, otherwise false
  */
 zathura_error_t pdf_page_render_cairo(zathura_page_t* page, mupdf_page_t* mupdf_page, cairo_t* cairo, bool printing);
+
+/**
+ * Draws an immediate approximation of the page onto a cairo object by
+ * resampling the largest raster the plugin kept of the page. Meant to be
+ * shown after a zoom change until pdf_page_render_cairo has finished.
+ *
+ * @param page Page
+ * @param cairo Cairo object
+ * @return ZATHURA_ERROR_OK if an approximation was drawn,
+ *   ZATHURA_ERROR_UNKNOWN if no raster of the page is available
+ */
+zathura_error_t pdf_page_render_preview_cairo(zathura_page_t* page, mupdf_page_t* mupdf_page, cairo_t* cairo);
+
+/**
+ * Redraws the dirty area of the page into a cairo image surface that holds
+ * the previous render of the page at the same size. Only the pixels below
+ * the changed annotations are rasterized again.
+ *
+ * @param page Page
+ * @param cairo Cairo object
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t pdf_page_render_dirty_cairo(zathura_page_t* page, mupdf_page_t* mupdf_page, cairo_t* cairo);
 #endif
 
 #endif // PDF_H
@@ -0,0 +1,425 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <string.h>
+#include <glib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pyramid.h"
+#include "utils.h"
+
+typedef struct mupdf_pyramid_level_s
+{
+  unsigned int width; /**< Width in pixels */
+  unsigned int height; /**< Height in pixels */
+  unsigned char* data; /**< Pixels, rowstride is width * 4 */
+} mupdf_pyramid_level_t;
+
+struct mupdf_pyramid_s
+{
+  double scalex; /**< Horizontal scale of the first level */
+  double scaley; /**< Vertical scale of the first level */
+  gsize size; /**< Number of bytes of all levels */
+  unsigned int n_levels; /**< Number of levels */
+  mupdf_pyramid_level_t levels[MUPDF_PYRAMID_MAX_LEVELS]; /**< Levels */
+};
+
+void
+mupdf_downscale_box(const unsigned char* source, int source_rowstride,
+    unsigned int width, unsigned int height, unsigned char* destination,
+    int destination_rowstride)
+{
+  for (unsigned int y = 0; y < height; y++) {
+    const unsigned char* row0 = source + (2 * y) * source_rowstride;
+    const unsigned char* row1 = row0 + source_rowstride;
+    unsigned char* out        = destination + y * destination_rowstride;
+    unsigned int x            = 0;
+
+#ifdef __SSE2__
+    /* four source pixels of two rows give two destination pixels; the sums
+     * are widened to 16 bit and rounded once like below */
+    __m128i zero     = _mm_setzero_si128();
+    __m128i rounding = _mm_set1_epi16(2);
+    for (; x + 2 <= width; x += 2) {
+      __m128i top    = _mm_loadu_si128((const __m128i*) (row0 + 8 * x));
+      __m128i bottom = _mm_loadu_si128((const __m128i*) (row1 + 8 * x));
+      __m128i left   = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+      __m128i right  = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+      left           = _mm_add_epi16(left, _mm_srli_si128(left, 8));
+      right          = _mm_add_epi16(right, _mm_srli_si128(right, 8));
+      __m128i sum    = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(left, right), rounding), 2);
+      _mm_storel_epi64((__m128i*) (out + 4 * x), _mm_packus_epi16(sum, zero));
+    }
+#endif
+
+    for (; x < width; x++) {
+      const unsigned char* a = row0 + 8 * x;
+      const unsigned char* b = row1 + 8 * x;
+      for (unsigned int c = 0; c < 4; c++) {
+        out[4 * x + c] = (a[c] + a[c + 4] + b[c] + b[c + 4] + 2) >> 2;
+      }
+    }
+  }
+}
+
+/* Weights are 7 bit so that products of differences fit into 16 bits */
+#define MUPDF_RESAMPLE_SHIFT 7
+
+static void
+mupdf_resample_pixel(const unsigned char* row0, const unsigned char* row1,
+    unsigned int x0, unsigned int x1, int wx, int wy, unsigned char* out)
+{
+  for (unsigned int c = 0; c < 4; c++) {
+    int top    = row0[4 * x0 + c] + (((row0[4 * x1 + c] - row0[4 * x0 + c]) * wx) >> MUPDF_RESAMPLE_SHIFT);
+    int bottom = row1[4 * x0 + c] + (((row1[4 * x1 + c] - row1[4 * x0 + c]) * wx) >> MUPDF_RESAMPLE_SHIFT);
+    out[c]     = top + (((bottom - top) * wy) >> MUPDF_RESAMPLE_SHIFT);
+  }
+}
+
+void
+mupdf_resample_bilinear(const unsigned char* source, int source_rowstride,
+    unsigned int source_width, unsigned int source_height,
+    unsigned char* destination, int destination_rowstride,
+    unsigned int width, unsigned int height)
+{
+  /* 16.16 fixed point step through the source, sampling pixel centers */
+  guint64 step_x = ((guint64) source_width << 16) / width;
+  guint64 step_y = ((guint64) source_height << 16) / height;
+
+  for (unsigned int y = 0; y < height; y++) {
+    gint64 sy       = (gint64) (y * step_y + step_y / 2) - (1 << 15);
+    sy              = CLAMP(sy, 0, ((gint64) source_height - 1) << 16);
+    unsigned int y0 = sy >> 16;
+    unsigned int y1 = MIN(y0 + 1, source_height - 1);
+    int wy          = (sy & 0xFFFF) >> (16 - MUPDF_RESAMPLE_SHIFT);
+
+    const unsigned char* row0 = source + (gsize) y0 * source_rowstride;
+    const unsigned char* row1 = source + (gsize) y1 * source_rowstride;
+    unsigned char* out        = destination + (gsize) y * destination_rowstride;
+
+#ifdef __SSE2__
+    __m128i zero     = _mm_setzero_si128();
+    __m128i weight_y = _mm_set1_epi16(wy);
+#endif
+
+    for (unsigned int x = 0; x < width; x++) {
+      gint64 sx       = (gint64) (x * step_x + step_x / 2) - (1 << 15);
+      sx              = CLAMP(sx, 0, ((gint64) source_width - 1) << 16);
+      unsigned int x0 = sx >> 16;
+      int wx          = (sx & 0xFFFF) >> (16 - MUPDF_RESAMPLE_SHIFT);
+
+#ifdef __SSE2__
+      if (x0 + 1 < source_width) {
+        /* both neighbours of a row are loaded at once and widened to 16 bit */
+        __m128i top    = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (row0 + 4 * x0)), zero);
+        __m128i bottom = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (row1 + 4 * x0)), zero);
+        __m128i v      = _mm_add_epi16(top, _mm_srai_epi16(_mm_mullo_epi16(
+                _mm_sub_epi16(bottom, top), weight_y), MUPDF_RESAMPLE_SHIFT));
+        __m128i right  = _mm_srli_si128(v, 8);
+        __m128i h      = _mm_add_epi16(v, _mm_srai_epi16(_mm_mullo_epi16(
+                _mm_sub_epi16(right, v), _mm_set1_epi16(wx)), MUPDF_RESAMPLE_SHIFT));
+        int pixel      = _mm_cvtsi128_si32(_mm_packus_epi16(h, zero));
+        memcpy(out + 4 * x, &pixel, 4);
+        continue;
+      }
+#endif
+
+      mupdf_resample_pixel(row0, row1, x0, MIN(x0 + 1, source_width - 1), wx, wy, out + 4 * x);
+    }
+  }
+}
+
+static void
+mupdf_pyramid_free(mupdf_pyramid_t* pyramid)
+{
+  if (pyramid == NULL) {
+    return;
+  }
+
+  for (unsigned int i = 0; i < pyramid->n_levels; i++) {
+    g_free(pyramid->levels[i].data);
+  }
+  g_free(pyramid);
+}
+
+/* Only the full raster is copied, the smaller levels are built on first
+ * use */
+static mupdf_pyramid_t*
+mupdf_pyramid_new(const unsigned char* image, int rowstride, unsigned int width,
+    unsigned int height, double scalex, double scaley)
+{
+  mupdf_pyramid_t* pyramid = g_malloc0(sizeof(mupdf_pyramid_t));
+  pyramid->scalex          = scalex;
+  pyramid->scaley          = scaley;
+
+  mupdf_pyramid_level_t* level = &pyramid->levels[0];
+  level->width                 = width;
+  level->height                = height;
+  level->data                  = g_malloc((gsize) width * height * 4);
+  for (unsigned int y = 0; y < height; y++) {
+    memcpy(level->data + (gsize) y * width * 4, image + (gsize) y * rowstride, (gsize) width * 4);
+  }
+  pyramid->size     = (gsize) width * height * 4;
+  pyramid->n_levels = 1;
+
+  return pyramid;
+}
+
+/* Number of levels the pyramid has once all of them have been built */
+static unsigned int
+mupdf_pyramid_max_levels(const mupdf_pyramid_t* pyramid)
+{
+  unsigned int n_levels = 1;
+  while (n_levels < MUPDF_PYRAMID_MAX_LEVELS &&
+      (pyramid->levels[0].width >> n_levels) >= MUPDF_PYRAMID_MIN_SIZE &&
+      (pyramid->levels[0].height >> n_levels) >= MUPDF_PYRAMID_MIN_SIZE) {
+    n_levels++;
+  }
+
+  return n_levels;
+}
+
+/* Builds the levels up to the given one if they do not exist yet, has to be
+ * called with the document mutex held */
+static mupdf_pyramid_level_t*
+mupdf_pyramid_get_level(mupdf_document_t* mupdf_document,
+    mupdf_pyramid_t* pyramid, unsigned int index)
+{
+  while (pyramid->n_levels <= index) {
+    mupdf_pyramid_level_t* previous = &pyramid->levels[pyramid->n_levels - 1];
+    mupdf_pyramid_level_t* level    = &pyramid->levels[pyramid->n_levels];
+    level->width                    = previous->width / 2;
+    level->height                   = previous->height / 2;
+    level->data                     = g_malloc((gsize) level->width * level->height * 4);
+    mupdf_downscale_box(previous->data, previous->width * 4, level->width,
+        level->height, level->data, level->width * 4);
+
+    pyramid->size                += (gsize) level->width * level->height * 4;
+    mupdf_document->pyramid_size += (gsize) level->width * level->height * 4;
+    pyramid->n_levels++;
+  }
+
+  return &pyramid->levels[index];
+}
+
+/* Drops the pyramid of the page, has to be called with the document mutex
+ * held */
+static void
+mupdf_pyramid_drop(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page)
+{
+  if (mupdf_page->pyramid == NULL) {
+    return;
+  }
+
+  g_queue_remove(&mupdf_document->pyramid_pages, mupdf_page);
+  mupdf_document->pyramid_size -= mupdf_page->pyramid->size;
+  mupdf_pyramid_free(mupdf_page->pyramid);
+  mupdf_page->pyramid = NULL;
+}
+
+/* Marks the pyramid of the page as most recently used and drops the least
+ * recently used ones to make room for the levels it has grown */
+static void
+mupdf_pyramid_touch(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page)
+{
+  g_queue_remove(&mupdf_document->pyramid_pages, mupdf_page);
+  g_queue_push_head(&mupdf_document->pyramid_pages, mupdf_page);
+
+  while (mupdf_document->pyramid_size > MUPDF_PYRAMID_MAX_SIZE &&
+      g_queue_get_length(&mupdf_document->pyramid_pages) > 1) {
+    mupdf_pyramid_drop(mupdf_document, g_queue_peek_tail(&mupdf_document->pyramid_pages));
+  }
+}
+
+/* Scales are derived from whole pixel sizes, so they are considered equal
+ * if they differ by at most half a pixel across the page */
+static bool
+mupdf_pyramid_scale_matches(double level_scale, double scale, unsigned int size)
+{
+  double difference = (level_scale > scale) ? level_scale - scale : scale - level_scale;
+
+  return difference * size <= 0.5 * scale;
+}
+
+bool
+mupdf_pyramid_copy(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+    unsigned char* image, int rowstride, unsigned int width,
+    unsigned int height, double scalex, double scaley, fz_cookie* cookie)
+{
+  if (mupdf_document == NULL || mupdf_page == NULL || image == NULL ||
+      width == 0 || height == 0) {
+    return false;
+  }
+
+  bool copied = false;
+
+  if (mupdf_document_lock_abortable(mupdf_document, cookie) == false) {
+    return false;
+  }
+
+  mupdf_pyramid_t* pyramid = mupdf_page->pyramid;
+  unsigned int n_levels    = (pyramid != NULL) ? mupdf_pyramid_max_levels(pyramid) : 0;
+  for (unsigned int i = 0; i < n_levels; i++) {
+    unsigned int level_width  = pyramid->levels[0].width >> i;
+    unsigned int level_height = pyramid->levels[0].height >> i;
+
+    /* halving rounds down, accept a difference of one pixel and repeat the
+     * last row and column */
+    if (mupdf_pyramid_scale_matches(pyramid->scalex / (1 << i), scalex, width) == false ||
+        mupdf_pyramid_scale_matches(pyramid->scaley / (1 << i), scaley, height) == false ||
+        level_width + 1 < width || level_width > width + 1 ||
+        level_height + 1 < height || level_height > height + 1) {
+      continue;
+    }
+
+    mupdf_pyramid_level_t* level = mupdf_pyramid_get_level(mupdf_document, pyramid, i);
+
+    for (unsigned int y = 0; y < height; y++) {
+      const unsigned char* source = level->data + (gsize) MIN(y, level->height - 1) * level->width * 4;
+      unsigned char* target       = image + (gsize) y * rowstride;
+      unsigned int columns        = MIN(width, level->width);
+
+      memcpy(target, source, (gsize) columns * 4);
+      if (columns < width) {
+        memcpy(target + columns * 4, source + (columns - 1) * 4, 4);
+      }
+    }
+
+    copied = true;
+    break;
+  }
+
+  if (copied == true) {
+    mupdf_pyramid_touch(mupdf_document, mupdf_page);
+  }
+
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  return copied;
+}
+
+void
+mupdf_pyramid_store(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+    const unsigned char* image, int rowstride, unsigned int width,
+    unsigned int height, double scalex, double scaley, unsigned int generation,
+    fz_cookie* cookie)
+{
+  if (mupdf_document == NULL || mupdf_page == NULL || image == NULL ||
+      width == 0 || height == 0) {
+    return;
+  }
+
+  if (mupdf_document_lock_abortable(mupdf_document, cookie) == false) {
+    return;
+  }
+
+  /* keep the pyramid built from the largest render, renders at the same
+   * scale leave it alone; the rasters may have been dropped while rendering */
+  mupdf_pyramid_t* pyramid = mupdf_page->pyramid;
+  bool replace             = (pyramid == NULL || pyramid->scalex * pyramid->scaley < scalex * scaley) &&
+    generation == mupdf_document->raster_generation &&
+    (gsize) width * height * 4 <= MUPDF_PYRAMID_MAX_SIZE;
+
+  if (replace == false) {
+    if (pyramid != NULL) {
+      mupdf_pyramid_touch(mupdf_document, mupdf_page);
+    }
+    g_mutex_unlock(&mupdf_document->mutex);
+    return;
+  }
+
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  /* the raster is copied without the lock */
+  pyramid = mupdf_pyramid_new(image, rowstride, width, height, scalex, scaley);
+
+  if (mupdf_document_lock_abortable(mupdf_document, cookie) == false) {
+    mupdf_pyramid_free(pyramid);
+    return;
+  }
+
+  /* another render may have stored a larger pyramid meanwhile */
+  if (generation != mupdf_document->raster_generation ||
+      (mupdf_page->pyramid != NULL &&
+       mupdf_page->pyramid->scalex * mupdf_page->pyramid->scaley >= scalex * scaley)) {
+    g_mutex_unlock(&mupdf_document->mutex);
+    mupdf_pyramid_free(pyramid);
+    return;
+  }
+
+  mupdf_pyramid_drop(mupdf_document, mupdf_page);
+  mupdf_page->pyramid           = pyramid;
+  mupdf_document->pyramid_size += pyramid->size;
+  mupdf_pyramid_touch(mupdf_document, mupdf_page);
+
+  g_mutex_unlock(&mupdf_document->mutex);
+}
+
+void
+mupdf_pyramid_clear(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page)
+{
+  if (mupdf_document == NULL || mupdf_page == NULL) {
+    return;
+  }
+
+  g_mutex_lock(&mupdf_document->mutex);
+  mupdf_pyramid_drop(mupdf_document, mupdf_page);
+  g_mutex_unlock(&mupdf_document->mutex);
+}
+
+void
+mupdf_pyramid_clear_all(mupdf_document_t* mupdf_document)
+{
+  mupdf_page_t* mupdf_page = NULL;
+
+  while ((mupdf_page = g_queue_pop_head(&mupdf_document->pyramid_pages)) != NULL) {
+    mupdf_pyramid_free(mupdf_page->pyramid);
+    mupdf_page->pyramid = NULL;
+  }
+
+  mupdf_document->pyramid_size = 0;
+}
+
+bool
+mupdf_pyramid_resample(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+    unsigned char* image, int rowstride, unsigned int width,
+    unsigned int height)
+{
+  if (mupdf_document == NULL || mupdf_page == NULL || image == NULL ||
+      width == 0 || height == 0) {
+    return false;
+  }
+
+  g_mutex_lock(&mupdf_document->mutex);
+
+  mupdf_pyramid_t* pyramid = mupdf_page->pyramid;
+  if (pyramid == NULL) {
+    g_mutex_unlock(&mupdf_document->mutex);
+    return false;
+  }
+
+  /* shrink by at most a factor of two from the chosen level, bilinear
+   * filtering aliases beyond that */
+  unsigned int index    = 0;
+  unsigned int n_levels = mupdf_pyramid_max_levels(pyramid);
+  for (unsigned int i = 1; i < n_levels; i++) {
+    if ((pyramid->levels[0].width >> i) < width || (pyramid->levels[0].height >> i) < height) {
+      break;
+    }
+    index = i;
+  }
+
+  mupdf_pyramid_level_t* level = mupdf_pyramid_get_level(mupdf_document, pyramid, index);
+
+  mupdf_resample_bilinear(level->data, level->width * 4, level->width,
+      level->height, image, rowstride, width, height);
+  mupdf_pyramid_touch(mupdf_document, mupdf_page);
+
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  return true;
+}
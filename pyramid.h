@@ -0,0 +1,127 @@
+/* See LICENSE file for license and copyright information */
+
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include "plugin.h"
+
+/** Maximum number of levels of a pyramid, including the full raster */
+#define MUPDF_PYRAMID_MAX_LEVELS 8
+
+/** Levels smaller than this in either dimension are not built */
+#define MUPDF_PYRAMID_MIN_SIZE 16
+
+/** Maximum number of bytes held by the pyramids of all pages */
+#define MUPDF_PYRAMID_MAX_SIZE (64 * 1024 * 1024)
+
+/**
+ * Copies the raster of the page from its pyramid if a level matches the
+ * requested scales and size. Scales match if they differ by at most half a
+ * device pixel across the page. Only 4 component rasters are kept.
+ *
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ * @param image Target buffer
+ * @param rowstride Rowstride of the target buffer
+ * @param width Width of the target buffer
+ * @param height Height of the target buffer
+ * @param scalex Requested horizontal scale
+ * @param scaley Requested vertical scale
+ * @param cookie Cookie of the render or NULL; nothing is copied if it is
+ *   aborted while waiting for the document mutex
+ * @return true if the raster has been copied, otherwise false
+ */
+bool mupdf_pyramid_copy(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+    unsigned char* image, int rowstride, unsigned int width,
+    unsigned int height, double scalex, double scaley, fz_cookie* cookie);
+
+/**
+ * Keeps a complete render as the base of the page's pyramid of successively
+ * halved rasters, unless the page already has one from a render at the same
+ * or a larger scale. The halved levels are built when they are first used.
+ * The least recently used pyramids are dropped to stay within
+ * MUPDF_PYRAMID_MAX_SIZE.
+ *
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ * @param image Rendered 4 component raster
+ * @param rowstride Rowstride of the raster
+ * @param width Width of the raster
+ * @param height Height of the raster
+ * @param scalex Horizontal scale the raster was rendered at
+ * @param scaley Vertical scale the raster was rendered at
+ * @param generation Raster generation the render started in, see
+ *   mupdf_document_raster_generation
+ * @param cookie Cookie of the render or NULL; nothing is kept if it is
+ *   aborted while waiting for the document mutex
+ */
+void mupdf_pyramid_store(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+    const unsigned char* image, int rowstride, unsigned int width,
+    unsigned int height, double scalex, double scaley, unsigned int generation,
+    fz_cookie* cookie);
+
+/**
+ * Drops the pyramid of the page, e.g. because its contents changed
+ *
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ */
+void mupdf_pyramid_clear(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page);
+
+/**
+ * Drops the pyramids of all pages. Has to be called with the document mutex
+ * held.
+ *
+ * @param mupdf_document Document
+ */
+void mupdf_pyramid_clear_all(mupdf_document_t* mupdf_document);
+
+/**
+ * Halves a 4 component raster in both dimensions with a 2x2 box filter
+ *
+ * @param source Source raster
+ * @param source_rowstride Rowstride of the source raster
+ * @param width Width of the destination raster
+ * @param height Height of the destination raster
+ * @param destination Destination raster
+ * @param destination_rowstride Rowstride of the destination raster
+ */
+void mupdf_downscale_box(const unsigned char* source, int source_rowstride,
+    unsigned int width, unsigned int height, unsigned char* destination,
+    int destination_rowstride);
+
+/**
+ * Draws an approximation of the page at an arbitrary size by resampling the
+ * best suited level of its pyramid
+ *
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ * @param image Target 4 component buffer
+ * @param rowstride Rowstride of the target buffer
+ * @param width Width of the target buffer
+ * @param height Height of the target buffer
+ * @return true if the page has a pyramid and the buffer was filled,
+ *   otherwise false
+ */
+bool mupdf_pyramid_resample(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+    unsigned char* image, int rowstride, unsigned int width,
+    unsigned int height);
+
+/**
+ * Resamples a 4 component raster with bilinear filtering
+ *
+ * @param source Source raster
+ * @param source_rowstride Rowstride of the source raster
+ * @param source_width Width of the source raster
+ * @param source_height Height of the source raster
+ * @param destination Destination raster
+ * @param destination_rowstride Rowstride of the destination raster
+ * @param width Width of the destination raster
+ * @param height Height of the destination raster
+ */
+void mupdf_resample_bilinear(const unsigned char* source, int source_rowstride,
+    unsigned int source_width, unsigned int source_height,
+    unsigned char* destination, int destination_rowstride,
+    unsigned int width, unsigned int height);
+
+#endif // PYRAMID_H
@@ -0,0 +1,167 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "registry.h"
+
+#define REGISTRY_DIRECTORY "zathura-pdf-mupdf"
+
+struct mupdf_registry_s
+{
+  GKeyFile* key_file; /**< Recorded page costs */
+  char* filename; /**< File the registry is stored in */
+  GMutex mutex; /**< Protects key_file and dirty */
+  bool dirty; /**< If the registry has to be written back */
+};
+
+static char*
+mupdf_registry_filename(const char* path)
+{
+  /* identify the document by location, size and modification time so that a
+   * changed file starts with a fresh registry */
+  GStatBuf buf;
+  if (g_stat(path, &buf) != 0) {
+    return NULL;
+  }
+
+  char* identity = g_strdup_printf("%s:%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT,
+      path, (gint64) buf.st_size, (gint64) buf.st_mtime);
+  char* checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA256, identity, -1);
+  char* basename = g_strconcat(checksum, ".ini", NULL);
+  char* filename = g_build_filename(g_get_user_cache_dir(), REGISTRY_DIRECTORY, basename, NULL);
+
+  g_free(basename);
+  g_free(checksum);
+  g_free(identity);
+
+  return filename;
+}
+
+static char*
+mupdf_registry_group(unsigned int page_index)
+{
+  return g_strdup_printf("page %u", page_index);
+}
+
+mupdf_registry_t*
+mupdf_registry_new(const char* path)
+{
+  if (path == NULL) {
+    return NULL;
+  }
+
+  char* filename = mupdf_registry_filename(path);
+  if (filename == NULL) {
+    return NULL;
+  }
+
+  mupdf_registry_t* registry = g_malloc0(sizeof(mupdf_registry_t));
+  registry->filename         = filename;
+  registry->key_file         = g_key_file_new();
+  g_mutex_init(&registry->mutex);
+
+  /* a missing registry just means that the document is new */
+  g_key_file_load_from_file(registry->key_file, filename, G_KEY_FILE_NONE, NULL);
+
+  return registry;
+}
+
+void
+mupdf_registry_free(mupdf_registry_t* registry)
+{
+  if (registry == NULL) {
+    return;
+  }
+
+  if (registry->dirty == true) {
+    char* directory = g_path_get_dirname(registry->filename);
+    if (g_mkdir_with_parents(directory, 0700) == 0) {
+      g_key_file_save_to_file(registry->key_file, registry->filename, NULL);
+    }
+    g_free(directory);
+  }
+
+  g_key_file_free(registry->key_file);
+  g_mutex_clear(&registry->mutex);
+  g_free(registry->filename);
+  g_free(registry);
+}
+
+static bool
+mupdf_registry_cost_is_slow(gint64 record_time, gint64 render_time, gint64 complexity)
+{
+  return record_time + render_time >= MUPDF_REGISTRY_SLOW_TIME ||
+    complexity >= MUPDF_REGISTRY_SLOW_COMPLEXITY;
+}
+
+void
+mupdf_registry_record(mupdf_registry_t* registry, unsigned int page_index,
+    gint64 record_time, gint64 render_time, unsigned int list_size,
+    unsigned int complexity)
+{
+  if (registry == NULL) {
+    return;
+  }
+
+  char* group = mupdf_registry_group(page_index);
+
+  g_mutex_lock(&registry->mutex);
+
+  bool known = (g_key_file_has_group(registry->key_file, group) == TRUE);
+
+  /* renders of a cached display list keep the recording cost of the entry */
+  gint64 record_ms  = record_time / G_TIME_SPAN_MILLISECOND;
+  gint64 render_ms  = render_time / G_TIME_SPAN_MILLISECOND;
+  gint64 operations = complexity;
+  if (record_time <= 0 && known == true) {
+    record_ms  = g_key_file_get_int64(registry->key_file, group, "record-time", NULL);
+    operations = g_key_file_get_integer(registry->key_file, group, "complexity", NULL);
+  }
+
+  /* only slow pages are worth remembering, the others are left out of the
+   * file and dropped once they stop being slow */
+  if (mupdf_registry_cost_is_slow(record_ms, render_ms, operations) == true) {
+    g_key_file_set_int64(registry->key_file, group, "record-time", record_ms);
+    g_key_file_set_integer(registry->key_file, group, "complexity", operations);
+    g_key_file_set_int64(registry->key_file, group, "render-time", render_ms);
+    g_key_file_set_integer(registry->key_file, group, "display-list-size", list_size);
+    registry->dirty = true;
+  } else if (known == true) {
+    g_key_file_remove_group(registry->key_file, group, NULL);
+    registry->dirty = true;
+  }
+
+  g_mutex_unlock(&registry->mutex);
+
+  g_free(group);
+}
+
+bool
+mupdf_registry_is_slow(mupdf_registry_t* registry, unsigned int page_index)
+{
+  if (registry == NULL) {
+    return false;
+  }
+
+  char* group = mupdf_registry_group(page_index);
+
+  g_mutex_lock(&registry->mutex);
+
+  bool slow = false;
+  if (g_key_file_has_group(registry->key_file, group) == TRUE) {
+    gint64 record_time = g_key_file_get_int64(registry->key_file, group, "record-time", NULL);
+    gint64 render_time = g_key_file_get_int64(registry->key_file, group, "render-time", NULL);
+    int complexity     = g_key_file_get_integer(registry->key_file, group, "complexity", NULL);
+
+    slow = mupdf_registry_cost_is_slow(record_time, render_time, complexity);
+  }
+
+  g_mutex_unlock(&registry->mutex);
+
+  g_free(group);
+
+  return slow;
+}
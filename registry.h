@@ -0,0 +1,56 @@
+/* See LICENSE file for license and copyright information */
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include "plugin.h"
+
+/** Pages taking longer than this (in ms) to record and render are slow */
+#define MUPDF_REGISTRY_SLOW_TIME 200
+
+/** Pages with more content operators than this are slow */
+#define MUPDF_REGISTRY_SLOW_COMPLEXITY 200000
+
+/**
+ * Loads the slow page registry of a document from the user's cache
+ * directory
+ *
+ * @param path Path of the document
+ * @return The registry or NULL if an error occurred
+ */
+mupdf_registry_t* mupdf_registry_new(const char* path);
+
+/**
+ * Writes the registry back if it has been modified and frees it
+ *
+ * @param registry The registry
+ */
+void mupdf_registry_free(mupdf_registry_t* registry);
+
+/**
+ * Records the cost of rendering a page. Only slow pages are kept, the entry
+ * of a page that is not slow anymore is removed.
+ *
+ * @param registry The registry
+ * @param page_index Index of the page
+ * @param record_time Time spent recording the display list in microseconds,
+ *   0 if a cached display list was used
+ * @param render_time Time spent rasterizing in microseconds
+ * @param list_size Number of nodes in the display list
+ * @param complexity Number of content operators interpreted while recording,
+ *   0 if a cached display list was used
+ */
+void mupdf_registry_record(mupdf_registry_t* registry, unsigned int page_index,
+    gint64 record_time, gint64 render_time, unsigned int list_size,
+    unsigned int complexity);
+
+/**
+ * Checks whether the page has been slow in the past
+ *
+ * @param registry The registry
+ * @param page_index Index of the page
+ * @return true if the page is known to be slow, otherwise false
+ */
+bool mupdf_registry_is_slow(mupdf_registry_t* registry, unsigned int page_index);
+
+#endif // REGISTRY_H
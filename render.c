@@ -5,14 +5,266 @@
 #include <glib.h>
 
 #include "plugin.h"
+#include "deadline.h"
+#include "dedup.h"
+#include "layer.h"
+#include "pyramid.h"
+#include "registry.h"
+#include "render.h"
+#include "scheduler.h"
+#include "utils.h"
 
+/* Slow pages are rasterized in bands of this many rows */
+#define MUPDF_TILE_HEIGHT 256
+
+/* Anti-aliasing level used for slow pages */
+#define MUPDF_DRAFT_AA_LEVEL 2
+
+/* The draw device writes BGRA pixels */
+#define MUPDF_PIXEL_SIZE 4
+
+/* Glyphs are prewarmed for this many pages around the viewport */
+#define MUPDF_GLYPH_PREWARM_DISTANCE 2
+
+static void
+mupdf_page_render_band(fz_context* ctx, fz_display_list* display_list,
+    unsigned char* image, int rowstride, const fz_irect* band,
+    const fz_matrix* ctm, bool clear, fz_cookie* cookie)
+{
+  fz_pixmap* pixmap = NULL;
+  fz_device* device = NULL;
+
+  fz_var(pixmap);
+  fz_var(device);
+
+  fz_try (ctx) {
+    /* the pixmap is a window into the image, bands need not span its width */
+    fz_colorspace* colorspace = fz_device_bgr(ctx);
+    pixmap = fz_new_pixmap_with_data(ctx, colorspace, band->x1 - band->x0,
+        band->y1 - band->y0, 1, rowstride,
+        image + band->y0 * rowstride + band->x0 * MUPDF_PIXEL_SIZE);
+    pixmap->x = band->x0;
+    pixmap->y = band->y0;
+    if (clear == true) {
+      fz_clear_pixmap_with_value(ctx, pixmap, 0xFF);
+    }
+
+    if (display_list != NULL) {
+      fz_rect rect;
+      fz_rect_from_irect(&rect, band);
+
+      device = fz_new_draw_device(ctx, NULL, pixmap);
+      fz_run_display_list(ctx, display_list, device, ctm, &rect, cookie);
+      fz_close_device(ctx, device);
+    }
+  } fz_always (ctx) {
+    fz_drop_device(ctx, device);
+    fz_drop_pixmap(ctx, pixmap);
+  } fz_catch (ctx) {
+    fz_rethrow(ctx);
+  }
+}
+
+/* Workers update the flag after every complete render */
+static bool
+mupdf_page_is_slow(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+    fz_cookie* cookie)
+{
+  if (mupdf_document_lock_abortable(mupdf_document, cookie) == false) {
+    return false;
+  }
+
+  bool slow = mupdf_page->slow;
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  return slow;
+}
+
+/* A complete raster stays complete if the deadline passes while it is copied
+ * or kept */
+static void
+mupdf_page_render_complete(mupdf_document_t* mupdf_document, fz_cookie* cookie)
+{
+  if (mupdf_deadline_disarm(mupdf_document->deadline, cookie) == true) {
+    cookie->abort = 0;
+  }
+}
+
+/* Renders into a BGRA buffer; pyramid tells whether the raster is kept for
+ * the previews drawn while zooming */
 static zathura_error_t
-pdf_page_render_to_buffer(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+mupdf_page_render_bgra(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, unsigned char* image, int rowstride,
+    bool pyramid, unsigned int page_width, unsigned int page_height,
+    double scalex, double scaley, fz_cookie* cookie)
+{
+  fz_cookie local_cookie = { 0 };
+  if (cookie == NULL) {
+    cookie = &local_cookie;
+  }
+
+  zathura_error_t error            = ZATHURA_ERROR_OK;
+  fz_display_list* display_list    = NULL;
+  fz_display_list* annotation_list = NULL;
+  unsigned int generation          = mupdf_document_raster_generation(mupdf_document);
+
+  fz_var(error);
+  fz_var(display_list);
+  fz_var(annotation_list);
+
+  /* annotations are drawn as a separate layer on top of the contents */
+  fz_try (ctx) {
+    annotation_list = mupdf_page_get_annotation_list(ctx, mupdf_document, mupdf_page, cookie);
+  } fz_catch (ctx) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  /* identical pages are only rendered once; an aborted cookie may have left
+   * the annotations out */
+  if (annotation_list == NULL && cookie->abort == 0 &&
+      mupdf_page_copy_shared_raster(ctx, mupdf_document, mupdf_page, image,
+        rowstride, page_width, page_height, scalex, scaley, cookie) == true) {
+    if (pyramid == true) {
+      mupdf_pyramid_store(mupdf_document, mupdf_page, image, rowstride,
+          page_width, page_height, scalex, scaley, generation, cookie);
+    }
+    mupdf_page_render_complete(mupdf_document, cookie);
+    return ZATHURA_ERROR_OK;
+  }
+
+  /* zooming out is served from the pyramid of a larger render */
+  if (pyramid == true && mupdf_pyramid_copy(mupdf_document, mupdf_page, image,
+        rowstride, page_width, page_height, scalex, scaley, cookie) == true) {
+    fz_drop_display_list(ctx, annotation_list);
+    mupdf_page_render_complete(mupdf_document, cookie);
+    return ZATHURA_ERROR_OK;
+  }
+
+  fz_matrix m;
+  fz_scale(&m, scalex, scaley);
+
+  /* known slow pages are drawn in bands and with less anti-aliasing */
+  bool slow                = mupdf_page_is_slow(mupdf_document, mupdf_page, cookie);
+  unsigned int band_height = (slow == true) ? MUPDF_TILE_HEIGHT : page_height;
+  int aa_level             = fz_aa_level(ctx);
+
+  /* the content layer is reused when only the annotations changed */
+  bool contents = (annotation_list == NULL || mupdf_layer_copy_contents(
+        mupdf_document, mupdf_page, image, rowstride, page_width, page_height,
+        scalex, scaley, NULL, cookie) == false);
+  gint64 start     = 0;
+  gint64 list_size = 0;
+
+  fz_var(start);
+  fz_var(list_size);
+
+  fz_try (ctx) {
+    if (slow == true) {
+      fz_set_aa_level(ctx, MUPDF_DRAFT_AA_LEVEL);
+    }
+
+    if (contents == true) {
+      display_list = mupdf_page_get_display_list(ctx, mupdf_document, mupdf_page, cookie);
+      if (display_list == NULL && cookie->abort == 0) {
+        /* recording failed */
+        error = ZATHURA_ERROR_UNKNOWN;
+      }
+
+      /* a recording stopped at the deadline is drawn as far as it got
+       * instead of leaving the page blank */
+      fz_cookie* draw_cookie = cookie;
+      if (cookie->abort != 0 && mupdf_deadline_disarm(mupdf_document->deadline, cookie) == true) {
+        draw_cookie = NULL;
+      }
+
+      start = g_get_monotonic_time();
+      for (unsigned int y = 0; y < page_height; y += band_height) {
+        fz_irect band = { .x0 = 0, .y0 = y, .x1 = page_width, .y1 = MIN(y + band_height, page_height) };
+        mupdf_page_render_band(ctx, display_list, image, rowstride, &band, &m, true, draw_cookie);
+      }
+      list_size = cookie->progress_max;
+
+      if (annotation_list != NULL && display_list != NULL && cookie->abort == 0) {
+        mupdf_layer_store_contents(mupdf_document, mupdf_page, image,
+            rowstride, page_width, page_height, scalex, scaley, generation,
+            cookie);
+      }
+    }
+
+    if (annotation_list != NULL) {
+      for (unsigned int y = 0; y < page_height; y += band_height) {
+        fz_irect band = { .x0 = 0, .y0 = y, .x1 = page_width, .y1 = MIN(y + band_height, page_height) };
+        mupdf_page_render_band(ctx, annotation_list, image, rowstride, &band, &m, false, cookie);
+      }
+    }
+  } fz_always (ctx) {
+    fz_set_aa_level(ctx, aa_level);
+    fz_drop_display_list(ctx, display_list);
+    fz_drop_display_list(ctx, annotation_list);
+  } fz_catch (ctx) {
+    error = ZATHURA_ERROR_UNKNOWN;
+  }
+
+  /* the drawing stopped at the first abort, so the raster is complete if the
+   * cookie has not been aborted by now */
+  if (error != ZATHURA_ERROR_OK || cookie->abort != 0) {
+    mupdf_deadline_disarm(mupdf_document->deadline, cookie);
+    return error;
+  }
+
+  gint64 render_time = g_get_monotonic_time() - start;
+
+  /* the bookkeeping below is skipped if the deadline passes while a worker
+   * holds the document mutex */
+  if (contents == true && display_list != NULL &&
+      mupdf_document_lock_abortable(mupdf_document, cookie) == true) {
+    /* the recording is reported by the first render using it */
+    gint64 record_time      = mupdf_page->record_time;
+    unsigned int complexity = mupdf_page->complexity;
+    mupdf_page->record_time = 0;
+    g_mutex_unlock(&mupdf_document->mutex);
+
+    mupdf_registry_record(mupdf_document->registry, mupdf_page->index,
+        record_time, render_time, list_size,
+        (record_time > 0) ? complexity : 0);
+    bool slow = mupdf_registry_is_slow(mupdf_document->registry, mupdf_page->index);
+
+    if (mupdf_document_lock_abortable(mupdf_document, cookie) == true) {
+      mupdf_page->slow = slow;
+      g_mutex_unlock(&mupdf_document->mutex);
+    }
+  }
+
+  /* a complete render covers all pending changes */
+  if (mupdf_document_lock_abortable(mupdf_document, cookie) == true) {
+    mupdf_page->dirty = fz_empty_rect;
+    g_mutex_unlock(&mupdf_document->mutex);
+  }
+
+  if (annotation_list == NULL) {
+    mupdf_page_store_shared_raster(mupdf_document, mupdf_page, image, rowstride,
+        page_width, page_height, scalex, scaley, generation, cookie);
+  }
+
+  if (pyramid == true) {
+    mupdf_pyramid_store(mupdf_document, mupdf_page, image, rowstride,
+        page_width, page_height, scalex, scaley, generation, cookie);
+  }
+
+  mupdf_page_render_complete(mupdf_document, cookie);
+
+  return error;
+}
+
+zathura_error_t
+pdf_page_render_to_buffer(fz_context* ctx, mupdf_document_t* mupdf_document,
+			  mupdf_page_t* mupdf_page,
 			  unsigned char* image, int rowstride, int components,
 			  unsigned int page_width, unsigned int page_height,
-			  double scalex, double scaley)
+			  double scalex, double scaley, fz_cookie* cookie)
 {
-  if (mupdf_document == NULL ||
+  if (ctx == NULL ||
+      mupdf_document == NULL ||
       mupdf_document->ctx == NULL ||
       mupdf_page == NULL ||
       mupdf_page->page == NULL ||
@@ -20,56 +272,190 @@ pdf_page_render_to_buffer(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_
     return ZATHURA_ERROR_UNKNOWN;
   }
 
-  fz_display_list* display_list = fz_new_display_list(mupdf_page->ctx, NULL);
-  fz_device* device             = fz_new_list_device(mupdf_page->ctx, display_list);
+  /* 4 component rasters are cairo surfaces, which are kept in a pyramid for
+   * the previews drawn while zooming */
+  if (components == MUPDF_PIXEL_SIZE) {
+    return mupdf_page_render_bgra(ctx, mupdf_document, mupdf_page, image,
+        rowstride, true, page_width, page_height, scalex, scaley, cookie);
+  } else if (components != 3) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
 
-  fz_try (mupdf_document->ctx) {
-    fz_matrix m;
-    fz_scale(&m, scalex, scaley);
-    fz_run_page(mupdf_document->ctx, mupdf_page->page, device, &m, NULL);
-  } fz_catch (mupdf_document->ctx) {
-    return ZATHURA_ERROR_UNKNOWN;
+  /* the draw device only writes BGRA, RGB buffers are converted from a
+   * scratch raster */
+  int scratch_rowstride  = page_width * MUPDF_PIXEL_SIZE;
+  unsigned char* scratch = g_try_malloc((gsize) scratch_rowstride * page_height);
+  if (scratch == NULL) {
+    return ZATHURA_ERROR_OUT_OF_MEMORY;
   }
 
-  fz_drop_device(mupdf_page->ctx, device);
+  zathura_error_t error = mupdf_page_render_bgra(ctx, mupdf_document,
+      mupdf_page, scratch, scratch_rowstride, false, page_width, page_height,
+      scalex, scaley, cookie);
 
-  fz_irect irect = { .x1 = page_width, .y1 = page_height };
-  fz_rect rect = { .x1 = page_width, .y1 = page_height };
+  if (error == ZATHURA_ERROR_OK) {
+    for (unsigned int y = 0; y < page_height; y++) {
+      const unsigned char* source = scratch + (gsize) y * scratch_rowstride;
+      unsigned char* target       = image + (gsize) y * rowstride;
+      for (unsigned int x = 0; x < page_width; x++) {
+        target[3 * x + 0] = source[MUPDF_PIXEL_SIZE * x + 2];
+        target[3 * x + 1] = source[MUPDF_PIXEL_SIZE * x + 1];
+        target[3 * x + 2] = source[MUPDF_PIXEL_SIZE * x + 0];
+      }
+    }
+  }
 
-  fz_colorspace* colorspace = fz_device_bgr(mupdf_document->ctx);
-  fz_pixmap* pixmap = fz_new_pixmap_with_bbox_and_data(mupdf_page->ctx, colorspace, &irect, 1, image);
-  fz_clear_pixmap_with_value(mupdf_page->ctx, pixmap, 0xFF);
+  g_free(scratch);
 
-  device = fz_new_draw_device(mupdf_page->ctx, NULL, pixmap);
-  fz_run_display_list(mupdf_page->ctx, display_list, device, &fz_identity, &rect, NULL);
-  fz_drop_device(mupdf_page->ctx, device);
+  return error;
+}
 
-  fz_drop_pixmap(mupdf_page->ctx, pixmap);
-  fz_drop_display_list(mupdf_page->ctx, display_list);
+void
+pdf_page_annotations_changed(zathura_page_t* page, mupdf_page_t* mupdf_page)
+{
+  if (page == NULL || mupdf_page == NULL) {
+    return;
+  }
 
-  return ZATHURA_ERROR_OK;
+  zathura_document_t* document = zathura_page_get_document(page);
+  if (document == NULL) {
+    return;
+  }
+
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    return;
+  }
+
+  g_mutex_lock(&mupdf_document->mutex);
+  fz_drop_display_list(ctx, mupdf_page->annotation_list);
+  mupdf_page->annotation_list       = NULL;
+  mupdf_page->annotation_list_valid = false;
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  /* the content layer stays valid, only the composited rasters are stale */
+  mupdf_pyramid_clear(mupdf_document, mupdf_page);
 }
 
-zathura_image_buffer_t*
-pdf_page_render(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_error_t* error)
+void
+pdf_page_annotation_changed(zathura_page_t* page, mupdf_page_t* mupdf_page,
+    fz_annot* annot)
 {
-  if (page == NULL || mupdf_page == NULL) {
-    if (error != NULL) {
-      *error = ZATHURA_ERROR_INVALID_ARGUMENTS;
-    }
-    return NULL;
+  if (page == NULL || mupdf_page == NULL || annot == NULL) {
+    return;
+  }
+
+  zathura_document_t* document = zathura_page_get_document(page);
+  if (document == NULL) {
+    return;
+  }
+
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    return;
+  }
+
+  g_mutex_lock(&mupdf_document->mutex);
+
+  fz_try (ctx) {
+    fz_rect rect;
+    fz_bound_annot(ctx, annot, &rect);
+    fz_union_rect(&mupdf_page->dirty, &rect);
+  } fz_catch (ctx) {
+    /* without a bbox the whole page has to be redrawn */
+    fz_union_rect(&mupdf_page->dirty, &mupdf_page->bbox);
+  }
+
+  fz_drop_display_list(ctx, mupdf_page->annotation_list);
+  mupdf_page->annotation_list       = NULL;
+  mupdf_page->annotation_list_valid = false;
+
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  mupdf_pyramid_clear(mupdf_document, mupdf_page);
+}
+
+static void
+mupdf_page_render_finished(zathura_page_t* page, mupdf_job_type_t
+    GIRARA_UNUSED(type), void* result, bool cancelled, void* data)
+{
+  mupdf_document_t* mupdf_document = data;
+
+  if (cancelled == true || result == NULL) {
+    return;
+  }
+
+  if (mupdf_document->render_callback != NULL) {
+    mupdf_document->render_callback(page, result, mupdf_document->render_callback_data);
+  } else {
+    zathura_image_buffer_free(result);
+  }
+}
+
+static void
+mupdf_page_render_begin(mupdf_document_t* mupdf_document, fz_cookie* cookie)
+{
+  if (mupdf_document->render_deadline != 0) {
+    mupdf_deadline_arm(mupdf_document->deadline, cookie, mupdf_document->render_deadline);
+  }
+}
+
+/* scalex and scaley are the scales of the render, 0 for the document scale */
+static void
+mupdf_page_render_end(mupdf_document_t* mupdf_document, zathura_page_t* page,
+    mupdf_page_t* mupdf_page, double scalex, double scaley, fz_cookie* cookie)
+{
+  mupdf_deadline_disarm(mupdf_document->deadline, cookie);
+
+  mupdf_page->render_incomplete = (cookie->abort != 0);
+  if (mupdf_page->render_incomplete == false) {
+    return;
+  }
+
+  /* finish the page in the background at the size of the incomplete image;
+   * without a callback only the display list is recorded so that the next
+   * render is fast */
+  if (mupdf_document->render_callback != NULL) {
+    mupdf_scheduler_push_render(mupdf_document->scheduler, page, scalex,
+        scaley, mupdf_page_render_finished, mupdf_document);
+  } else {
+    mupdf_scheduler_push(mupdf_document->scheduler, MUPDF_JOB_PREFETCH, page,
+        NULL, NULL);
   }
+}
+
+/* The buffer size is truncated like the surfaces the host allocates, and
+ * the page is stretched over the whole pixels instead of leaving a partially
+ * covered row and column */
+static void
+mupdf_page_fit_scale(zathura_page_t* page, double* scalex, double* scaley,
+    unsigned int* page_width, unsigned int* page_height)
+{
+  double width  = zathura_page_get_width(page);
+  double height = zathura_page_get_height(page);
+
+  *page_width  = MAX(*scalex * width, 1);
+  *page_height = MAX(*scaley * height, 1);
+
+  *scalex = *page_width / width;
+  *scaley = *page_height / height;
+}
 
+zathura_image_buffer_t*
+mupdf_page_render_image_buffer_scaled(fz_context* ctx, zathura_page_t* page,
+    mupdf_page_t* mupdf_page, double scalex, double scaley, fz_cookie* cookie,
+    zathura_error_t* error)
+{
   zathura_document_t* document = zathura_page_get_document(page);
   if (document == NULL) {
     return NULL;
   }
 
-  /* calculate sizes */
-  double scalex            = zathura_document_get_scale(document);
-  double scaley            = scalex;
-  unsigned int page_width  = scalex * zathura_page_get_width(page);
-  unsigned int page_height = scaley * zathura_page_get_height(page);
+  unsigned int page_width  = 0;
+  unsigned int page_height = 0;
+  mupdf_page_fit_scale(page, &scalex, &scaley, &page_width, &page_height);
 
   /* create image buffer */
   zathura_image_buffer_t* image_buffer = zathura_image_buffer_create(page_width, page_height);
@@ -86,8 +472,9 @@ pdf_page_render(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_error_t*
 
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
 
-  zathura_error_t error_render = pdf_page_render_to_buffer(mupdf_document, mupdf_page, image, rowstride, 3,
-						page_width, page_height, scalex, scaley);
+  zathura_error_t error_render = pdf_page_render_to_buffer(ctx, mupdf_document, mupdf_page,
+						image, rowstride, 3, page_width, page_height,
+						scalex, scaley, cookie);
 
   if (error_render != ZATHURA_ERROR_OK) {
     zathura_image_buffer_free(image_buffer);
@@ -100,6 +487,206 @@ pdf_page_render(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_error_t*
   return image_buffer;
 }
 
+zathura_image_buffer_t*
+mupdf_page_render_image_buffer(fz_context* ctx, zathura_page_t* page,
+    mupdf_page_t* mupdf_page, fz_cookie* cookie, zathura_error_t* error)
+{
+  if (ctx == NULL || page == NULL || mupdf_page == NULL) {
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_INVALID_ARGUMENTS;
+    }
+    return NULL;
+  }
+
+  zathura_document_t* document = zathura_page_get_document(page);
+  if (document == NULL) {
+    return NULL;
+  }
+
+  /* rasterize at device resolution right away */
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  double scale                     = zathura_document_get_scale(document);
+
+  return mupdf_page_render_image_buffer_scaled(ctx, page, mupdf_page,
+      scale * mupdf_document->device_scalex,
+      scale * mupdf_document->device_scaley, cookie, error);
+}
+
+void
+mupdf_page_prewarm_glyphs(fz_context* ctx, zathura_page_t* page,
+    mupdf_page_t* mupdf_page, fz_cookie* cookie)
+{
+  zathura_document_t* document = zathura_page_get_document(page);
+  if (ctx == NULL || document == NULL || mupdf_page == NULL) {
+    return;
+  }
+
+  /* glyphs are cached per transformation, so use exactly the scale of the
+   * next render */
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  double scale                     = zathura_document_get_scale(document);
+  double scalex                    = scale * mupdf_document->device_scalex;
+  double scaley                    = scale * mupdf_document->device_scaley;
+  unsigned int page_width          = 0;
+  unsigned int page_height         = 0;
+  mupdf_page_fit_scale(page, &scalex, &scaley, &page_width, &page_height);
+
+  fz_matrix m;
+  fz_scale(&m, scalex, scaley);
+
+  fz_pixmap* pixmap = NULL;
+  fz_device* device = NULL;
+  int aa_level      = fz_aa_level(ctx);
+
+  fz_var(pixmap);
+  fz_var(device);
+
+  fz_try (ctx) {
+    /* glyphs are rendered into the cache regardless of the clip, drawing
+     * them onto a single pixel costs nothing */
+    pixmap = fz_new_pixmap(ctx, fz_device_bgr(ctx), 1, 1, 1);
+    device = fz_new_draw_device(ctx, NULL, pixmap);
+    fz_enable_device_hints(ctx, device, FZ_IGNORE_IMAGE | FZ_IGNORE_SHADE);
+
+    if (mupdf_page_is_slow(mupdf_document, mupdf_page, cookie) == true) {
+      fz_set_aa_level(ctx, MUPDF_DRAFT_AA_LEVEL);
+    }
+
+    mupdf_page_run_display_lists(ctx, mupdf_document, mupdf_page, device, &m,
+        &fz_infinite_rect, cookie);
+    fz_close_device(ctx, device);
+  } fz_always (ctx) {
+    fz_set_aa_level(ctx, aa_level);
+    fz_drop_device(ctx, device);
+    fz_drop_pixmap(ctx, pixmap);
+  } fz_catch (ctx) {
+  }
+}
+
+void
+pdf_document_scale_changed(zathura_document_t* document,
+    mupdf_document_t* mupdf_document, unsigned int first_page,
+    unsigned int last_page)
+{
+  if (document == NULL || mupdf_document == NULL || first_page > last_page) {
+    return;
+  }
+
+  mupdf_scheduler_set_viewport(mupdf_document->scheduler, first_page, last_page);
+
+  unsigned int n_pages = zathura_document_get_number_of_pages(document);
+  unsigned int first   = (first_page > MUPDF_GLYPH_PREWARM_DISTANCE) ? first_page - MUPDF_GLYPH_PREWARM_DISTANCE : 0;
+  unsigned int last    = MIN(last_page + MUPDF_GLYPH_PREWARM_DISTANCE + 1, n_pages);
+
+  for (unsigned int i = first; i < last; i++) {
+    zathura_page_t* page = zathura_document_get_page(document, i);
+    if (page != NULL && zathura_page_get_data(page) != NULL) {
+      mupdf_scheduler_push(mupdf_document->scheduler, MUPDF_JOB_GLYPHS, page,
+          NULL, NULL);
+    }
+  }
+}
+
+zathura_image_buffer_t*
+pdf_page_render(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_error_t* error)
+{
+  if (page == NULL || mupdf_page == NULL) {
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_INVALID_ARGUMENTS;
+    }
+    return NULL;
+  }
+
+  zathura_document_t* document = zathura_page_get_document(page);
+  if (document == NULL) {
+    return NULL;
+  }
+
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  fz_cookie cookie                 = { 0 };
+
+  mupdf_page_render_begin(mupdf_document, &cookie);
+  zathura_image_buffer_t* image_buffer = mupdf_page_render_image_buffer(
+      ctx, page, mupdf_page, &cookie, error);
+  mupdf_page_render_end(mupdf_document, page, mupdf_page, 0, 0, &cookie);
+
+  return image_buffer;
+}
+
+zathura_image_buffer_t*
+pdf_page_render_scaled(zathura_page_t* page, mupdf_page_t* mupdf_page,
+    double scalex, double scaley, zathura_error_t* error)
+{
+  if (page == NULL || mupdf_page == NULL || scalex <= 0 || scaley <= 0) {
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_INVALID_ARGUMENTS;
+    }
+    return NULL;
+  }
+
+  zathura_document_t* document = zathura_page_get_document(page);
+  if (document == NULL) {
+    return NULL;
+  }
+
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  fz_cookie cookie                 = { 0 };
+
+  mupdf_page_render_begin(mupdf_document, &cookie);
+  zathura_image_buffer_t* image_buffer = mupdf_page_render_image_buffer_scaled(
+      ctx, page, mupdf_page, scalex, scaley, &cookie, error);
+  mupdf_page_render_end(mupdf_document, page, mupdf_page, scalex, scaley, &cookie);
+
+  return image_buffer;
+}
+
+zathura_error_t
+pdf_document_set_device_scale(mupdf_document_t* mupdf_document, double x, double y)
+{
+  if (mupdf_document == NULL || x <= 0 || y <= 0) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  mupdf_document->device_scalex = x;
+  mupdf_document->device_scaley = y;
+
+  return ZATHURA_ERROR_OK;
+}
+
+zathura_error_t
+pdf_document_set_render_deadline(mupdf_document_t* mupdf_document,
+    unsigned int milliseconds, mupdf_render_callback_t callback, void* data)
+{
+  if (mupdf_document == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  if (milliseconds != 0 && mupdf_document->deadline == NULL) {
+    mupdf_document->deadline = mupdf_deadline_new();
+    if (mupdf_document->deadline == NULL) {
+      return ZATHURA_ERROR_UNKNOWN;
+    }
+  }
+
+  mupdf_document->render_deadline      = milliseconds;
+  mupdf_document->render_callback      = callback;
+  mupdf_document->render_callback_data = data;
+
+  return ZATHURA_ERROR_OK;
+}
+
+bool
+pdf_page_render_is_incomplete(mupdf_page_t* mupdf_page)
+{
+  if (mupdf_page == NULL) {
+    return false;
+  }
+
+  return mupdf_page->render_incomplete;
+}
+
 #if HAVE_CAIRO
 zathura_error_t
 pdf_page_render_cairo(zathura_page_t* page, mupdf_page_t* mupdf_page, cairo_t* cairo, bool GIRARA_UNUSED(printing))
@@ -130,9 +717,162 @@ pdf_page_render_cairo(zathura_page_t* page, mupdf_page_t* mupdf_page, cairo_t* c
   unsigned char* image = cairo_image_surface_get_data(surface);
 
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  fz_cookie cookie                 = { 0 };
+
+  mupdf_page_render_begin(mupdf_document, &cookie);
+  zathura_error_t error = pdf_page_render_to_buffer(ctx, mupdf_document,
+				   mupdf_page, image, rowstride, 4, page_width, page_height,
+				   scalex, scaley, &cookie);
+  mupdf_page_render_end(mupdf_document, page, mupdf_page, scalex, scaley, &cookie);
+
+  return error;
+}
+
+zathura_error_t
+pdf_page_render_preview_cairo(zathura_page_t* page, mupdf_page_t* mupdf_page, cairo_t* cairo)
+{
+  if (page == NULL || mupdf_page == NULL || cairo == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  cairo_surface_t* surface = cairo_get_target(cairo);
+  if (surface == NULL ||
+      cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ||
+      cairo_surface_get_type(surface) != CAIRO_SURFACE_TYPE_IMAGE) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  zathura_document_t* document = zathura_page_get_document(page);
+  if (document == NULL) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+
+  cairo_surface_flush(surface);
+
+  if (mupdf_pyramid_resample(mupdf_document, mupdf_page,
+        cairo_image_surface_get_data(surface),
+        cairo_image_surface_get_stride(surface),
+        cairo_image_surface_get_width(surface),
+        cairo_image_surface_get_height(surface)) == false) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  cairo_surface_mark_dirty(surface);
+
+  return ZATHURA_ERROR_OK;
+}
+
+static zathura_error_t
+mupdf_page_render_region(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, unsigned char* image, int rowstride,
+    unsigned int page_width, unsigned int page_height, double scalex,
+    double scaley, const fz_irect* region, fz_cookie* cookie)
+{
+  fz_matrix m;
+  fz_scale(&m, scalex, scaley);
+
+  zathura_error_t error            = ZATHURA_ERROR_OK;
+  fz_display_list* display_list    = NULL;
+  fz_display_list* annotation_list = NULL;
+
+  fz_var(error);
+  fz_var(display_list);
+  fz_var(annotation_list);
+
+  fz_try (ctx) {
+    /* the contents below the region come from the content layer if possible */
+    if (mupdf_layer_copy_contents(mupdf_document, mupdf_page, image, rowstride,
+          page_width, page_height, scalex, scaley, region, cookie) == false) {
+      display_list = mupdf_page_get_display_list(ctx, mupdf_document, mupdf_page, cookie);
+      if (display_list == NULL && cookie->abort == 0) {
+        error = ZATHURA_ERROR_UNKNOWN;
+      }
+      mupdf_page_render_band(ctx, display_list, image, rowstride, region, &m, true, cookie);
+    }
+
+    annotation_list = mupdf_page_get_annotation_list(ctx, mupdf_document, mupdf_page, cookie);
+    if (annotation_list != NULL) {
+      mupdf_page_render_band(ctx, annotation_list, image, rowstride, region, &m, false, cookie);
+    }
+  } fz_always (ctx) {
+    fz_drop_display_list(ctx, display_list);
+    fz_drop_display_list(ctx, annotation_list);
+  } fz_catch (ctx) {
+    error = ZATHURA_ERROR_UNKNOWN;
+  }
+
+  return error;
+}
+
+zathura_error_t
+pdf_page_render_dirty_cairo(zathura_page_t* page, mupdf_page_t* mupdf_page, cairo_t* cairo)
+{
+  if (page == NULL || mupdf_page == NULL || cairo == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  cairo_surface_t* surface = cairo_get_target(cairo);
+  if (surface == NULL ||
+      cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ||
+      cairo_surface_get_type(surface) != CAIRO_SURFACE_TYPE_IMAGE) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  zathura_document_t* document = zathura_page_get_document(page);
+  if (document == NULL) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  g_mutex_lock(&mupdf_document->mutex);
+  fz_rect dirty     = mupdf_page->dirty;
+  mupdf_page->dirty = fz_empty_rect;
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  if (fz_is_empty_rect(&dirty)) {
+    return ZATHURA_ERROR_OK;
+  }
+
+  unsigned int page_width  = cairo_image_surface_get_width(surface);
+  unsigned int page_height = cairo_image_surface_get_height(surface);
+
+  double scalex = ((double) page_width) / zathura_page_get_width(page);
+  double scaley = ((double) page_height) /zathura_page_get_height(page);
+
+  /* transform the changed area to device space, widened to whole pixels */
+  fz_matrix m;
+  fz_scale(&m, scalex, scaley);
+  fz_transform_rect(&dirty, &m);
+
+  fz_irect region;
+  fz_irect bounds = { .x1 = page_width, .y1 = page_height };
+  fz_round_rect(&region, &dirty);
+  fz_intersect_irect(&region, &bounds);
+
+  if (fz_is_empty_irect(&region)) {
+    return ZATHURA_ERROR_OK;
+  }
+
+  int rowstride        = cairo_image_surface_get_stride(surface);
+  unsigned char* image = cairo_image_surface_get_data(surface);
+  fz_cookie cookie     = { 0 };
+
+  cairo_surface_flush(surface);
+  zathura_error_t error = mupdf_page_render_region(ctx, mupdf_document,
+      mupdf_page, image, rowstride, page_width, page_height, scalex, scaley,
+      &region, &cookie);
+  cairo_surface_mark_dirty_rectangle(surface, region.x0, region.y0,
+      region.x1 - region.x0, region.y1 - region.y0);
 
-  return pdf_page_render_to_buffer(mupdf_document, mupdf_page, image, rowstride, 4,
-				   page_width, page_height, scalex, scaley);
+  return error;
 }
 #endif
 
@@ -0,0 +1,81 @@
+/* See LICENSE file for license and copyright information */
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "plugin.h"
+
+/**
+ * Rasterizes the page into the given buffer
+ *
+ * @param ctx Context of the calling thread
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ * @param image Target buffer
+ * @param rowstride Rowstride of the target buffer
+ * @param components Number of components per pixel, 4 for BGRA buffers
+ *   like cairo image surfaces or 3 for RGB buffers like
+ *   zathura_image_buffer_t
+ * @param page_width Width of the target buffer in pixels
+ * @param page_height Height of the target buffer in pixels
+ * @param scalex Horizontal scale
+ * @param scaley Vertical scale
+ * @param cookie Cookie used to abort rendering or NULL
+ * @return ZATHURA_ERROR_OK when no error occurred, otherwise see
+ *    zathura_error_t
+ */
+zathura_error_t pdf_page_render_to_buffer(fz_context* ctx,
+    mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+    unsigned char* image, int rowstride, int components,
+    unsigned int page_width, unsigned int page_height,
+    double scalex, double scaley, fz_cookie* cookie);
+
+/**
+ * Renders the page at the current document scale, multiplied by the device
+ * scale, into a newly allocated image buffer
+ *
+ * @param ctx Context of the calling thread
+ * @param page Page
+ * @param mupdf_page Page data
+ * @param cookie Cookie used to abort rendering or NULL
+ * @param error Set to an error value (see zathura_error_t) if an
+ *   error occurred
+ * @return Image buffer or NULL if an error occurred
+ */
+zathura_image_buffer_t* mupdf_page_render_image_buffer(fz_context* ctx,
+    zathura_page_t* page, mupdf_page_t* mupdf_page, fz_cookie* cookie,
+    zathura_error_t* error);
+
+/**
+ * Renders the page at the given scales into a newly allocated image buffer.
+ * The scales are adjusted so the page fills whole pixels, see
+ * pdf_page_render_scaled.
+ *
+ * @param ctx Context of the calling thread
+ * @param page Page
+ * @param mupdf_page Page data
+ * @param scalex Horizontal scale in device pixels per point
+ * @param scaley Vertical scale in device pixels per point
+ * @param cookie Cookie used to abort rendering or NULL
+ * @param error Set to an error value (see zathura_error_t) if an
+ *   error occurred
+ * @return Image buffer or NULL if an error occurred
+ */
+zathura_image_buffer_t* mupdf_page_render_image_buffer_scaled(fz_context* ctx,
+    zathura_page_t* page, mupdf_page_t* mupdf_page, double scalex,
+    double scaley, fz_cookie* cookie, zathura_error_t* error);
+
+/**
+ * Runs the display lists of the page at the current document scale through a
+ * draw device that only rasterizes glyphs, filling the shared glyph cache so
+ * that the next render of the page does not pay for them
+ *
+ * @param ctx Context of the calling thread
+ * @param page Page
+ * @param mupdf_page Page data
+ * @param cookie Cookie used to abort prewarming or NULL
+ */
+void mupdf_page_prewarm_glyphs(fz_context* ctx, zathura_page_t* page,
+    mupdf_page_t* mupdf_page, fz_cookie* cookie);
+
+#endif // RENDER_H
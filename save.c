@@ -0,0 +1,377 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "deflate.h"
+#include "downsample.h"
+#include "export.h"
+#include "save.h"
+
+typedef struct mupdf_save_job_s
+{
+  fz_context* ctx; /**< Clone of the document context used by the thread */
+  mupdf_document_t* mupdf_document; /**< Document */
+  char* path; /**< Target path */
+  mupdf_save_options_t options; /**< Save options */
+  fz_cookie* cookie; /**< Cookie of the caller or NULL */
+  mupdf_save_callback_t callback; /**< Called once the save has finished */
+  void* data; /**< Custom data passed to callback */
+  GThread* previous; /**< Thread of the previous save, joined first, or NULL */
+} mupdf_save_job_t;
+
+/* Copies the written document over the target, which keeps its inode and
+ * so its hard links, owner and ACLs */
+static bool
+mupdf_save_copy_in_place(const char* source, const char* target)
+{
+  char buffer[65536];
+  bool copied = false;
+
+  int in = open(source, O_RDONLY);
+  if (in == -1) {
+    goto error_ret;
+  }
+
+  int out = open(target, O_WRONLY | O_TRUNC);
+  if (out == -1) {
+    goto error_close;
+  }
+
+  ssize_t length = 0;
+  while ((length = read(in, buffer, sizeof(buffer))) > 0) {
+    for (ssize_t written = 0; written < length;) {
+      ssize_t n = write(out, buffer + written, length - written);
+      if (n < 0) {
+        goto error_out;
+      }
+      written += n;
+    }
+  }
+
+  copied = (length == 0 && fsync(out) == 0);
+
+error_out:
+
+  close(out);
+
+error_close:
+
+  close(in);
+
+error_ret:
+
+  return copied;
+}
+
+/* Creates a temporary file next to target with the owner and permissions of
+ * target_stat, if given, otherwise with the permissions of a new file as
+ * the umask allows. owner_kept is set to false if the owner could not be
+ * given to the file. */
+static char*
+mupdf_save_temporary(const char* target, const struct stat* target_stat,
+    bool* owner_kept)
+{
+  /* the temporary file has to be on the same file system to be renamed */
+  char* temporary = g_strdup_printf("%s.XXXXXX", target);
+  int fd          = g_mkstemp_full(temporary, O_RDWR, 0666);
+  if (fd == -1) {
+    g_free(temporary);
+    return NULL;
+  }
+
+  *owner_kept = true;
+  if (target_stat != NULL) {
+    if (fchown(fd, target_stat->st_uid, target_stat->st_gid) != 0) {
+      *owner_kept = false;
+    }
+    fchmod(fd, target_stat->st_mode & 07777);
+  }
+  close(fd);
+
+  return temporary;
+}
+
+/* Resampling images, compressing streams, garbage collection and
+ * linearization change the document they run on and take long. They run on
+ * a copy opened from the plain save, never on the open document, so its
+ * mutex is only held while the plain save is written. */
+static bool
+mupdf_save_process(fz_context* ctx, const char* source, const char* path,
+    const char* password, const mupdf_save_options_t* options, fz_cookie* cookie)
+{
+  fz_document* document = NULL;
+  pdf_document* copy    = NULL;
+  GArray* originals     = NULL;
+  GArray* deflated      = NULL;
+  bool processed        = false;
+
+  fz_var(document);
+  fz_var(copy);
+  fz_var(originals);
+  fz_var(deflated);
+  fz_var(processed);
+
+  fz_try (ctx) {
+    document = mupdf_export_open_document(ctx, source, password);
+
+    copy = pdf_specifics(ctx, document);
+    if (copy == NULL) {
+      fz_throw(ctx, FZ_ERROR_GENERIC, "not a PDF document");
+    }
+
+    /* resampled images and compressed streams replace the original ones in
+     * the copy, so mupdf writes them as they are */
+    if (options->image_dpi > 0) {
+      originals = mupdf_document_downsample_images(ctx, copy,
+          options->image_dpi, cookie);
+    }
+
+    if (options->compress == true && cookie->abort == 0) {
+      deflated = mupdf_document_deflate_streams(ctx, copy, cookie);
+    }
+
+    pdf_write_options write_options = { 0 };
+    if (options->optimize == true) {
+      /* 4 also compares the data of streams to merge duplicates */
+      write_options.do_garbage = 4;
+      write_options.do_linear  = 1;
+    }
+
+    if (cookie->abort == 0) {
+      pdf_save_document(ctx, copy, path, &write_options);
+      processed = true;
+    }
+  } fz_always (ctx) {
+    /* garbage collection renumbers the objects, and the copy is dropped
+     * anyway, so the originals are only freed */
+    mupdf_document_deflate_restore(ctx, NULL, deflated);
+    mupdf_document_downsample_restore(ctx, NULL, originals);
+    fz_drop_document(ctx, document);
+  } fz_catch (ctx) {
+    processed = false;
+  }
+
+  return processed;
+}
+
+zathura_error_t
+mupdf_document_save(fz_context* ctx, mupdf_document_t* mupdf_document,
+    const char* path, const mupdf_save_options_t* options, fz_cookie* cookie)
+{
+  if (ctx == NULL || mupdf_document == NULL || path == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  pdf_document* document = pdf_specifics(ctx, mupdf_document->document);
+  if (document == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  fz_cookie local_cookie = { 0 };
+  if (cookie == NULL) {
+    cookie = &local_cookie;
+  }
+
+  cookie->progress     = 0;
+  cookie->progress_max = MUPDF_SAVE_STEPS;
+
+  /* a symbolic link is kept and its target replaced */
+  char* resolved = realpath(path, NULL);
+  char* target   = g_strdup((resolved != NULL) ? resolved : path);
+  free(resolved);
+
+  /* a rename would break hard links, so such files are overwritten */
+  struct stat target_stat;
+  bool exists   = (stat(target, &target_stat) == 0);
+  bool in_place = (exists == true && target_stat.st_nlink > 1);
+
+  zathura_error_t error             = ZATHURA_ERROR_OK;
+  pdf_write_options write_options   = { 0 };
+  mupdf_save_options_t save_options = { 0 };
+  char* plain                       = NULL;
+  bool owner_kept                   = true;
+  if (options != NULL) {
+    save_options = *options;
+  }
+  bool process = (save_options.image_dpi > 0 || save_options.compress == true ||
+      save_options.optimize == true);
+
+  /* keep the owner and permissions of the file that is replaced; if the
+   * owner cannot be kept, the file is overwritten as well */
+  char* temporary = mupdf_save_temporary(target, (exists == true) ? &target_stat : NULL,
+      &owner_kept);
+  if (temporary == NULL) {
+    g_free(target);
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+  if (owner_kept == false) {
+    in_place = true;
+  }
+
+  /* a processed document is written from a plain copy */
+  if (process == true) {
+    plain = mupdf_save_temporary(target, (exists == true) ? &target_stat : NULL,
+        &owner_kept);
+    if (plain == NULL) {
+      error = ZATHURA_ERROR_UNKNOWN;
+    }
+  }
+
+  fz_var(error);
+
+  /* only the plain save, which copies the streams as they are, blocks
+   * the document */
+  if (error == ZATHURA_ERROR_OK && cookie->abort == 0) {
+    g_mutex_lock(&mupdf_document->mutex);
+
+    /* the open document stays as dirty as it was */
+    int dirty = document->dirty;
+
+    fz_try (ctx) {
+      pdf_save_document(ctx, document, (plain != NULL) ? plain : temporary,
+          &write_options);
+    } fz_always (ctx) {
+      document->dirty = dirty;
+      g_mutex_unlock(&mupdf_document->mutex);
+    } fz_catch (ctx) {
+      error = ZATHURA_ERROR_UNKNOWN;
+    }
+  }
+
+  /* a copy that cannot be processed, e.g. because it cannot be reopened,
+   * is written as it is */
+  if (plain != NULL && error == ZATHURA_ERROR_OK && cookie->abort == 0 &&
+      mupdf_save_process(ctx, plain, temporary, mupdf_document->password,
+        &save_options, cookie) == false && cookie->abort == 0 &&
+      g_rename(plain, temporary) != 0) {
+    error = ZATHURA_ERROR_UNKNOWN;
+  }
+
+  if (error == ZATHURA_ERROR_OK && cookie->abort == 0) {
+    cookie->progress = 1;
+
+    /* the new document has to be on disk before it replaces the old one */
+    int fd = open(temporary, O_RDONLY);
+    if (fd == -1 || fsync(fd) != 0) {
+      error = ZATHURA_ERROR_UNKNOWN;
+    }
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+
+  bool renamed = false;
+  if (error == ZATHURA_ERROR_OK && cookie->abort == 0) {
+    cookie->progress = 2;
+
+    if (in_place == true) {
+      if (mupdf_save_copy_in_place(temporary, target) == false) {
+        error = ZATHURA_ERROR_UNKNOWN;
+      }
+    } else {
+      renamed = (g_rename(temporary, target) == 0);
+      if (renamed == false) {
+        error = ZATHURA_ERROR_UNKNOWN;
+      }
+    }
+
+    if (error == ZATHURA_ERROR_OK) {
+      cookie->progress = MUPDF_SAVE_STEPS;
+    }
+  }
+
+  if (renamed == false) {
+    g_unlink(temporary);
+  }
+  if (plain != NULL) {
+    g_unlink(plain);
+  }
+  g_free(plain);
+  g_free(temporary);
+  g_free(target);
+
+  return error;
+}
+
+static gpointer
+mupdf_save_thread(gpointer data)
+{
+  mupdf_save_job_t* job = data;
+
+  /* saves of a document are written one after the other */
+  if (job->previous != NULL) {
+    g_thread_join(job->previous);
+  }
+
+  zathura_error_t error = mupdf_document_save(job->ctx, job->mupdf_document,
+      job->path, &job->options, job->cookie);
+
+  if (job->callback != NULL) {
+    job->callback(job->path, error, job->data);
+  }
+
+  fz_drop_context(job->ctx);
+  g_free(job->path);
+  g_free(job);
+
+  return NULL;
+}
+
+zathura_error_t
+pdf_document_save_as_async(mupdf_document_t* mupdf_document, const char* path,
+    const mupdf_save_options_t* options, fz_cookie* cookie,
+    mupdf_save_callback_t callback, void* data)
+{
+  if (mupdf_document == NULL || path == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  fz_context* ctx = fz_clone_context(mupdf_document->ctx);
+  if (ctx == NULL) {
+    return ZATHURA_ERROR_OUT_OF_MEMORY;
+  }
+
+  mupdf_save_job_t* job = g_malloc0(sizeof(mupdf_save_job_t));
+
+  job->ctx            = ctx;
+  job->mupdf_document = mupdf_document;
+  job->path           = g_strdup(path);
+  job->cookie         = cookie;
+  job->callback       = callback;
+  job->data           = data;
+  job->previous       = mupdf_document->save_thread;
+
+  if (options != NULL) {
+    job->options = *options;
+  }
+
+  /* the new thread takes over joining the previous one */
+  GThread* thread = g_thread_try_new("pdf-save", mupdf_save_thread, job, NULL);
+  if (thread == NULL) {
+    fz_drop_context(ctx);
+    g_free(job->path);
+    g_free(job);
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  mupdf_document->save_thread = thread;
+
+  return ZATHURA_ERROR_OK;
+}
+
+void
+mupdf_document_wait_save(mupdf_document_t* mupdf_document)
+{
+  if (mupdf_document->save_thread != NULL) {
+    g_thread_join(mupdf_document->save_thread);
+    mupdf_document->save_thread = NULL;
+  }
+}
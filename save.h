@@ -0,0 +1,47 @@
+/* See LICENSE file for license and copyright information */
+
+#ifndef SAVE_H
+#define SAVE_H
+
+#include <mupdf/pdf.h>
+
+#include "plugin.h"
+
+/** Number of steps a save reports in the progress of its cookie */
+#define MUPDF_SAVE_STEPS 3
+
+/**
+ * Writes the document to a temporary file next to path and renames it to
+ * path once it is on disk, so path always holds either the old or the
+ * complete new document. The document mutex is held while the document is
+ * written as it is, which makes the file a consistent snapshot. Images are
+ * resampled, streams compressed and the file optimized on a copy reopened
+ * from that snapshot, without the mutex.
+ *
+ * Symbolic links are resolved and their target is replaced. Files with
+ * several hard links, or whose owner cannot be given to the temporary file,
+ * are overwritten in place with the finished document instead, which keeps
+ * their links, owner and ACLs.
+ *
+ * @param ctx Context of the calling thread
+ * @param mupdf_document Document
+ * @param path Target path
+ * @param options Save options or NULL for the defaults
+ * @param cookie Cookie used to abort the save before path is replaced, or
+ *   NULL. Its progress counts the finished steps of MUPDF_SAVE_STEPS: the
+ *   document has been written, synced and renamed.
+ * @return ZATHURA_ERROR_OK when no error occurred, also if the save was
+ *    aborted, otherwise see zathura_error_t
+ */
+zathura_error_t mupdf_document_save(fz_context* ctx,
+    mupdf_document_t* mupdf_document, const char* path,
+    const mupdf_save_options_t* options, fz_cookie* cookie);
+
+/**
+ * Waits for the background saves of the document to finish
+ *
+ * @param mupdf_document Document
+ */
+void mupdf_document_wait_save(mupdf_document_t* mupdf_document);
+
+#endif // SAVE_H
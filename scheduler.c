@@ -0,0 +1,390 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <glib.h>
+
+#include "scheduler.h"
+#include "render.h"
+#include "search.h"
+#include "utils.h"
+
+typedef struct mupdf_job_s
+{
+  mupdf_job_type_t type; /**< Job type */
+  zathura_page_t* page; /**< Page */
+  unsigned int page_index; /**< Index of the page */
+  double scalex; /**< Horizontal scale of MUPDF_JOB_RENDER, 0 for the document scale */
+  double scaley; /**< Vertical scale of MUPDF_JOB_RENDER, 0 for the document scale */
+  fz_cookie cookie; /**< Cookie used to abort the job */
+  char* text; /**< Search item of MUPDF_JOB_SEARCH */
+  fz_cookie* search_cookie; /**< Cookie of the caller of MUPDF_JOB_SEARCH */
+  mupdf_search_callback_t search_callback; /**< Per page callback of MUPDF_JOB_SEARCH */
+  mupdf_job_callback_t callback; /**< Completion callback */
+  void* data; /**< Custom data passed to the callback */
+  guint64 sequence; /**< Submission order */
+} mupdf_job_t;
+
+struct mupdf_scheduler_s
+{
+  mupdf_document_t* mupdf_document; /**< Document */
+  GThreadPool* pool; /**< Worker threads */
+  GMutex mutex; /**< Protects jobs and sequence */
+  GCond cond; /**< Signalled whenever a job is finished */
+  GList* jobs; /**< Queued and running jobs */
+  guint64 sequence; /**< Sequence number of the next job */
+  volatile gint first_page; /**< First page of the viewport */
+  volatile gint last_page; /**< Last page of the viewport */
+};
+
+static unsigned int
+mupdf_scheduler_distance(mupdf_scheduler_t* scheduler, unsigned int page_index)
+{
+  int first = g_atomic_int_get(&scheduler->first_page);
+  int last  = g_atomic_int_get(&scheduler->last_page);
+  int index = page_index;
+
+  if (index < first) {
+    return first - index;
+  } else if (index > last) {
+    return index - last;
+  }
+
+  return 0;
+}
+
+static void
+mupdf_scheduler_abort_job(mupdf_job_t* job)
+{
+  job->cookie.abort = 1;
+
+  /* a search polls the cookie of its caller */
+  if (job->search_cookie != NULL) {
+    job->search_cookie->abort = 1;
+  }
+}
+
+static gint
+mupdf_scheduler_compare_jobs(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const mupdf_job_t* job_a     = a;
+  const mupdf_job_t* job_b     = b;
+  mupdf_scheduler_t* scheduler = user_data;
+
+  /* Aborted jobs are no-ops, get them out of the way first */
+  if ((job_a->cookie.abort != 0) != (job_b->cookie.abort != 0)) {
+    return job_a->cookie.abort != 0 ? -1 : 1;
+  }
+
+  unsigned int distance_a = mupdf_scheduler_distance(scheduler, job_a->page_index);
+  unsigned int distance_b = mupdf_scheduler_distance(scheduler, job_b->page_index);
+  if (distance_a != distance_b) {
+    return distance_a < distance_b ? -1 : 1;
+  }
+
+  if (job_a->type != job_b->type) {
+    return job_a->type < job_b->type ? -1 : 1;
+  }
+
+  if (job_a->sequence != job_b->sequence) {
+    return job_a->sequence < job_b->sequence ? -1 : 1;
+  }
+
+  return 0;
+}
+
+static void
+mupdf_scheduler_run_job(gpointer data, gpointer user_data)
+{
+  mupdf_job_t* job                 = data;
+  mupdf_scheduler_t* scheduler     = user_data;
+  mupdf_document_t* mupdf_document = scheduler->mupdf_document;
+  mupdf_page_t* mupdf_page         = zathura_page_get_data(job->page);
+  void* result                     = NULL;
+  unsigned int searched            = 0;
+
+  /* Every job runs on its own clone as contexts must not be shared between
+   * threads */
+  fz_context* ctx = NULL;
+  if (job->cookie.abort == 0 && mupdf_page != NULL) {
+    ctx = fz_clone_context(mupdf_document->ctx);
+  }
+
+  if (ctx != NULL) {
+    switch (job->type) {
+      case MUPDF_JOB_RENDER:
+        if (job->scalex > 0 && job->scaley > 0) {
+          result = mupdf_page_render_image_buffer_scaled(ctx, job->page,
+              mupdf_page, job->scalex, job->scaley, &job->cookie, NULL);
+        } else {
+          result = mupdf_page_render_image_buffer(ctx, job->page, mupdf_page, &job->cookie, NULL);
+        }
+        break;
+      case MUPDF_JOB_TEXT:
+        mupdf_page_extract_text(ctx, mupdf_document, mupdf_page, &job->cookie);
+        break;
+      case MUPDF_JOB_PREFETCH:
+        fz_drop_display_list(ctx, mupdf_page_get_display_list(ctx,
+              mupdf_document, mupdf_page, &job->cookie));
+        fz_drop_display_list(ctx, mupdf_page_get_annotation_list(ctx,
+              mupdf_document, mupdf_page, &job->cookie));
+        break;
+      case MUPDF_JOB_GLYPHS:
+        mupdf_page_prewarm_glyphs(ctx, job->page, mupdf_page, &job->cookie);
+        break;
+      case MUPDF_JOB_SEARCH:
+        searched = mupdf_document_search(ctx, zathura_page_get_document(job->page),
+            mupdf_document, job->text, job->search_cookie, job->search_callback,
+            job->data);
+        break;
+    }
+
+    fz_drop_context(ctx);
+  }
+
+  bool cancelled = job->cookie.abort != 0;
+  if (cancelled == true && result != NULL) {
+    zathura_image_buffer_free(result);
+    result = NULL;
+  }
+
+  if (job->callback != NULL) {
+    job->callback(job->page, job->type, result, cancelled, job->data);
+  }
+
+  /* the end of a search is reported even if it never started; the caller
+   * may free its cookie from then on, so aborts must no longer reach it */
+  if (job->type == MUPDF_JOB_SEARCH) {
+    g_mutex_lock(&scheduler->mutex);
+    job->search_cookie = NULL;
+    g_mutex_unlock(&scheduler->mutex);
+
+    job->search_callback(searched, zathura_document_get_number_of_pages(
+          zathura_page_get_document(job->page)), NULL, job->data);
+  }
+
+  g_mutex_lock(&scheduler->mutex);
+  scheduler->jobs = g_list_remove(scheduler->jobs, job);
+  g_cond_broadcast(&scheduler->cond);
+  g_mutex_unlock(&scheduler->mutex);
+
+  g_free(job->text);
+  g_free(job);
+}
+
+mupdf_scheduler_t*
+mupdf_scheduler_new(mupdf_document_t* mupdf_document, unsigned int n_threads)
+{
+  if (mupdf_document == NULL || mupdf_document->ctx == NULL) {
+    return NULL;
+  }
+
+  if (n_threads == 0) {
+    n_threads = g_get_num_processors();
+  }
+
+  mupdf_scheduler_t* scheduler = g_malloc0(sizeof(mupdf_scheduler_t));
+  scheduler->mupdf_document    = mupdf_document;
+
+  g_mutex_init(&scheduler->mutex);
+  g_cond_init(&scheduler->cond);
+
+  scheduler->pool = g_thread_pool_new(mupdf_scheduler_run_job, scheduler,
+      n_threads, FALSE, NULL);
+  if (scheduler->pool == NULL) {
+    g_cond_clear(&scheduler->cond);
+    g_mutex_clear(&scheduler->mutex);
+    g_free(scheduler);
+    return NULL;
+  }
+
+  g_thread_pool_set_sort_function(scheduler->pool, mupdf_scheduler_compare_jobs, scheduler);
+
+  return scheduler;
+}
+
+void
+mupdf_scheduler_free(mupdf_scheduler_t* scheduler)
+{
+  if (scheduler == NULL) {
+    return;
+  }
+
+  g_mutex_lock(&scheduler->mutex);
+  for (GList* iter = scheduler->jobs; iter != NULL; iter = g_list_next(iter)) {
+    mupdf_scheduler_abort_job(iter->data);
+  }
+  g_mutex_unlock(&scheduler->mutex);
+
+  /* Let the aborted jobs drain so that every callback is called */
+  g_thread_pool_free(scheduler->pool, FALSE, TRUE);
+
+  g_list_free(scheduler->jobs);
+  g_cond_clear(&scheduler->cond);
+  g_mutex_clear(&scheduler->mutex);
+  g_free(scheduler);
+}
+
+static mupdf_job_t*
+mupdf_scheduler_new_job(mupdf_job_type_t type, zathura_page_t* page,
+    mupdf_job_callback_t callback, void* data)
+{
+  mupdf_job_t* job = g_malloc0(sizeof(mupdf_job_t));
+  job->type        = type;
+  job->page        = page;
+  job->page_index  = zathura_page_get_index(page);
+  job->callback    = callback;
+  job->data        = data;
+
+  return job;
+}
+
+static bool
+mupdf_scheduler_queue_job(mupdf_scheduler_t* scheduler, mupdf_job_t* job)
+{
+  g_mutex_lock(&scheduler->mutex);
+  job->sequence   = scheduler->sequence++;
+  scheduler->jobs = g_list_prepend(scheduler->jobs, job);
+  g_mutex_unlock(&scheduler->mutex);
+
+  if (g_thread_pool_push(scheduler->pool, job, NULL) == FALSE) {
+    g_mutex_lock(&scheduler->mutex);
+    scheduler->jobs = g_list_remove(scheduler->jobs, job);
+    g_mutex_unlock(&scheduler->mutex);
+    g_free(job->text);
+    g_free(job);
+    return false;
+  }
+
+  return true;
+}
+
+bool
+mupdf_scheduler_push(mupdf_scheduler_t* scheduler, mupdf_job_type_t type,
+    zathura_page_t* page, mupdf_job_callback_t callback, void* data)
+{
+  if (scheduler == NULL || page == NULL) {
+    return false;
+  }
+
+  return mupdf_scheduler_queue_job(scheduler,
+      mupdf_scheduler_new_job(type, page, callback, data));
+}
+
+bool
+mupdf_scheduler_push_render(mupdf_scheduler_t* scheduler, zathura_page_t* page,
+    double scalex, double scaley, mupdf_job_callback_t callback, void* data)
+{
+  if (scheduler == NULL || page == NULL) {
+    return false;
+  }
+
+  mupdf_job_t* job = mupdf_scheduler_new_job(MUPDF_JOB_RENDER, page, callback, data);
+  job->scalex      = scalex;
+  job->scaley      = scaley;
+
+  return mupdf_scheduler_queue_job(scheduler, job);
+}
+
+bool
+mupdf_scheduler_push_search(mupdf_scheduler_t* scheduler, zathura_page_t* page,
+    const char* text, fz_cookie* cookie, mupdf_search_callback_t callback,
+    void* data)
+{
+  if (scheduler == NULL || page == NULL || text == NULL || callback == NULL) {
+    return false;
+  }
+
+  mupdf_job_t* job     = mupdf_scheduler_new_job(MUPDF_JOB_SEARCH, page, NULL, data);
+  job->text            = g_strdup(text);
+  job->search_cookie   = (cookie != NULL) ? cookie : &job->cookie;
+  job->search_callback = callback;
+
+  return mupdf_scheduler_queue_job(scheduler, job);
+}
+
+void
+mupdf_scheduler_set_viewport(mupdf_scheduler_t* scheduler,
+    unsigned int first_page, unsigned int last_page)
+{
+  if (scheduler == NULL) {
+    return;
+  }
+
+  if (last_page < first_page) {
+    unsigned int tmp = first_page;
+    first_page       = last_page;
+    last_page        = tmp;
+  }
+
+  g_atomic_int_set(&scheduler->first_page, first_page);
+  g_atomic_int_set(&scheduler->last_page, last_page);
+
+  g_mutex_lock(&scheduler->mutex);
+  for (GList* iter = scheduler->jobs; iter != NULL; iter = g_list_next(iter)) {
+    mupdf_job_t* job = iter->data;
+    if (job->type != MUPDF_JOB_SEARCH &&
+        mupdf_scheduler_distance(scheduler, job->page_index) > MUPDF_SCHEDULER_STALE_DISTANCE) {
+      mupdf_scheduler_abort_job(job);
+    }
+  }
+  g_mutex_unlock(&scheduler->mutex);
+
+  /* Setting the sort function again re-sorts the pending jobs */
+  g_thread_pool_set_sort_function(scheduler->pool, mupdf_scheduler_compare_jobs, scheduler);
+}
+
+/* A search reads every page, so it belongs to all of them */
+static bool
+mupdf_scheduler_is_page_job(mupdf_job_t* job, unsigned int page_index)
+{
+  return job->page_index == page_index || job->type == MUPDF_JOB_SEARCH;
+}
+
+static bool
+mupdf_scheduler_has_page_jobs(mupdf_scheduler_t* scheduler, unsigned int page_index)
+{
+  for (GList* iter = scheduler->jobs; iter != NULL; iter = g_list_next(iter)) {
+    if (mupdf_scheduler_is_page_job(iter->data, page_index) == true) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void
+mupdf_scheduler_cancel_page(mupdf_scheduler_t* scheduler, unsigned int page_index)
+{
+  if (scheduler == NULL) {
+    return;
+  }
+
+  g_mutex_lock(&scheduler->mutex);
+
+  for (GList* iter = scheduler->jobs; iter != NULL; iter = g_list_next(iter)) {
+    mupdf_job_t* job = iter->data;
+    if (mupdf_scheduler_is_page_job(job, page_index) == true) {
+      mupdf_scheduler_abort_job(job);
+    }
+  }
+
+  /* Move the aborted jobs to the front of the queue */
+  g_thread_pool_set_sort_function(scheduler->pool, mupdf_scheduler_compare_jobs, scheduler);
+
+  while (mupdf_scheduler_has_page_jobs(scheduler, page_index) == true) {
+    g_cond_wait(&scheduler->cond, &scheduler->mutex);
+  }
+
+  g_mutex_unlock(&scheduler->mutex);
+}
+
+unsigned int
+mupdf_scheduler_get_queue_depth(mupdf_scheduler_t* scheduler)
+{
+  if (scheduler == NULL) {
+    return 0;
+  }
+
+  return g_thread_pool_unprocessed(scheduler->pool);
+}
@@ -0,0 +1,129 @@
+/* See LICENSE file for license and copyright information */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "plugin.h"
+
+/** Pages further away from the viewport than this are considered stale */
+#define MUPDF_SCHEDULER_STALE_DISTANCE 8
+
+typedef enum mupdf_job_type_e
+{
+  MUPDF_JOB_RENDER, /**< Rasterize the page at the current scale */
+  MUPDF_JOB_TEXT, /**< Extract the text of the page */
+  MUPDF_JOB_PREFETCH, /**< Record the display list of the page */
+  MUPDF_JOB_GLYPHS, /**< Fill the glyph cache for the page at the current scale */
+  MUPDF_JOB_SEARCH /**< Search the whole document, see mupdf_scheduler_push_search */
+} mupdf_job_type_t;
+
+/**
+ * Called from a worker thread once a job has finished or was cancelled
+ *
+ * @param page The page of the job
+ * @param type The type of the job
+ * @param result For MUPDF_JOB_RENDER the rendered image buffer (owned by the
+ *   callee, free with zathura_image_buffer_free), otherwise NULL
+ * @param cancelled true if the job was cancelled before it was completed
+ * @param data Custom data
+ */
+typedef void (*mupdf_job_callback_t)(zathura_page_t* page,
+    mupdf_job_type_t type, void* result, bool cancelled, void* data);
+
+/**
+ * Creates a new scheduler for the document
+ *
+ * @param mupdf_document The document
+ * @param n_threads Number of worker threads, 0 to use one per processor
+ * @return The scheduler or NULL if an error occurred
+ */
+mupdf_scheduler_t* mupdf_scheduler_new(mupdf_document_t* mupdf_document,
+    unsigned int n_threads);
+
+/**
+ * Cancels all jobs, waits for the workers to finish and frees the scheduler
+ *
+ * @param scheduler The scheduler
+ */
+void mupdf_scheduler_free(mupdf_scheduler_t* scheduler);
+
+/**
+ * Queues a job. Jobs are run in order of their distance to the viewport,
+ * renders before text extraction before prefetching before glyph
+ * prewarming before searches.
+ *
+ * @param scheduler The scheduler
+ * @param type The job type
+ * @param page The page
+ * @param callback Called once the job has finished or NULL
+ * @param data Custom data passed to the callback
+ * @return true if the job was queued, otherwise false
+ */
+bool mupdf_scheduler_push(mupdf_scheduler_t* scheduler, mupdf_job_type_t type,
+    zathura_page_t* page, mupdf_job_callback_t callback, void* data);
+
+/**
+ * Queues a MUPDF_JOB_RENDER job like mupdf_scheduler_push, but the page is
+ * rendered at the given scales instead of the document scale
+ *
+ * @param scheduler The scheduler
+ * @param page The page
+ * @param scalex Horizontal scale, 0 for the document scale
+ * @param scaley Vertical scale, 0 for the document scale
+ * @param callback Called once the job has finished or NULL
+ * @param data Custom data passed to the callback
+ * @return true if the job was queued, otherwise false
+ */
+bool mupdf_scheduler_push_render(mupdf_scheduler_t* scheduler,
+    zathura_page_t* page, double scalex, double scaley,
+    mupdf_job_callback_t callback, void* data);
+
+/**
+ * Queues a MUPDF_JOB_SEARCH job searching all pages of the document in
+ * order. The search is not aborted when the viewport moves, but by
+ * mupdf_scheduler_cancel_page for any page, as it reads every page.
+ *
+ * @param scheduler The scheduler
+ * @param page The first page of the document
+ * @param text Search item (copied)
+ * @param cookie Cookie used to abort the search, or NULL. It has to stay
+ *   valid until callback has been called with NULL hits.
+ * @param callback Called with the hits of every completely searched page
+ *   and once more with NULL hits when the search has ended
+ * @param data Custom data passed to the callback
+ * @return true if the job was queued, otherwise false
+ */
+bool mupdf_scheduler_push_search(mupdf_scheduler_t* scheduler,
+    zathura_page_t* page, const char* text, fz_cookie* cookie,
+    mupdf_search_callback_t callback, void* data);
+
+/**
+ * Updates the viewport. Queued jobs are reordered and jobs for pages further
+ * than MUPDF_SCHEDULER_STALE_DISTANCE pages away from the viewport are
+ * aborted.
+ *
+ * @param scheduler The scheduler
+ * @param first_page Index of the first visible page
+ * @param last_page Index of the last visible page
+ */
+void mupdf_scheduler_set_viewport(mupdf_scheduler_t* scheduler,
+    unsigned int first_page, unsigned int last_page);
+
+/**
+ * Aborts all jobs of a page and waits until none of them is running anymore
+ *
+ * @param scheduler The scheduler
+ * @param page_index Index of the page
+ */
+void mupdf_scheduler_cancel_page(mupdf_scheduler_t* scheduler,
+    unsigned int page_index);
+
+/**
+ * Returns the number of queued jobs which have not been started yet
+ *
+ * @param scheduler The scheduler
+ * @return Number of pending jobs
+ */
+unsigned int mupdf_scheduler_get_queue_depth(mupdf_scheduler_t* scheduler);
+
+#endif // SCHEDULER_H
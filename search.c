@@ -2,11 +2,12 @@
 
 #define _POSIX_C_SOURCE 1
 
-#define N_SEARCH_RESULTS 512
-
 #include <glib.h>
 
 #include "plugin.h"
+#include "match.h"
+#include "scheduler.h"
+#include "search.h"
 #include "utils.h"
 
 girara_list_t*
@@ -24,7 +25,11 @@ pdf_page_search_text(zathura_page_t* page, mupdf_page_t* mupdf_page, const char*
     goto error_ret;
   }
 
-  mupdf_document_t* mupdf_document = zathura_document_get_data(document);;
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    goto error_ret;
+  }
 
   girara_list_t* list = girara_list_new2(g_free);
   if (list == NULL) {
@@ -35,26 +40,28 @@ pdf_page_search_text(zathura_page_t* page, mupdf_page_t* mupdf_page, const char*
   }
 
   /* extract text */
-  if (mupdf_page->extracted_text == false) {
-    mupdf_page_extract_text(mupdf_document, mupdf_page);
-  }
+  mupdf_page_extract_text(ctx, mupdf_document, mupdf_page, NULL);
+
+  GArray* hits = g_array_new(FALSE, FALSE, sizeof(fz_rect));
 
-  fz_rect* hit_bbox = fz_malloc_array(mupdf_page->ctx, N_SEARCH_RESULTS, sizeof(fz_rect));
-  int num_results = fz_search_stext_page(mupdf_page->ctx, mupdf_page->text,
-      (char*) text, hit_bbox, N_SEARCH_RESULTS);
+  g_mutex_lock(&mupdf_document->mutex);
+  unsigned int num_results = mupdf_search_stext_page(ctx,
+      mupdf_page->text, text, hits, NULL);
+  g_mutex_unlock(&mupdf_document->mutex);
 
-  for (int i = 0; i < num_results; i++) {
+  for (unsigned int i = 0; i < num_results; i++) {
+    fz_rect* hit_bbox              = &g_array_index(hits, fz_rect, i);
     zathura_rectangle_t* rectangle = g_malloc0(sizeof(zathura_rectangle_t));
 
-    rectangle->x1 = hit_bbox[i].x0;
-    rectangle->x2 = hit_bbox[i].x1;
-    rectangle->y1 = hit_bbox[i].y0;
-    rectangle->y2 = hit_bbox[i].y1;
+    rectangle->x1 = hit_bbox->x0;
+    rectangle->x2 = hit_bbox->x1;
+    rectangle->y1 = hit_bbox->y0;
+    rectangle->y2 = hit_bbox->y1;
 
     girara_list_append(list, rectangle);
   }
 
-  fz_free(mupdf_page->ctx, hit_bbox);
+  g_array_free(hits, TRUE);
 
   return list;
 
@@ -73,3 +80,139 @@ error_ret:
   return NULL;
 }
 
+
+static girara_list_t*
+mupdf_page_search_quads(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, const char* text, fz_cookie* cookie)
+{
+  girara_list_t* list = girara_list_new2(g_free);
+  if (list == NULL) {
+    return NULL;
+  }
+
+  /* an aborted extraction leaves nothing to search */
+  if (mupdf_page_extract_text(ctx, mupdf_document, mupdf_page, cookie) == false) {
+    return list;
+  }
+
+  GArray* quads = g_array_new(FALSE, FALSE, sizeof(mupdf_quad_t));
+
+  g_mutex_lock(&mupdf_document->mutex);
+  mupdf_search_stext_quads(ctx, mupdf_page->text, text, quads, cookie);
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  for (unsigned int i = 0; i < quads->len; i++) {
+    girara_list_append(list, g_memdup(&g_array_index(quads, mupdf_quad_t, i),
+          sizeof(mupdf_quad_t)));
+  }
+
+  g_array_free(quads, TRUE);
+
+  return list;
+}
+
+girara_list_t*
+pdf_page_search_text_quads(zathura_page_t* page, mupdf_page_t* mupdf_page,
+    const char* text, fz_cookie* cookie, zathura_error_t* error)
+{
+  if (page == NULL || text == NULL) {
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_INVALID_ARGUMENTS;
+    }
+    goto error_ret;
+  }
+
+  zathura_document_t* document = zathura_page_get_document(page);
+  if (document == NULL || mupdf_page == NULL || mupdf_page->text == NULL) {
+    goto error_ret;
+  }
+
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    goto error_ret;
+  }
+
+  girara_list_t* list = mupdf_page_search_quads(ctx,
+      mupdf_document, mupdf_page, text, cookie);
+  if (list == NULL) {
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_OUT_OF_MEMORY;
+    }
+    goto error_ret;
+  }
+
+  return list;
+
+error_ret:
+
+  if (error != NULL && *error == ZATHURA_ERROR_OK) {
+    *error = ZATHURA_ERROR_UNKNOWN;
+  }
+
+  return NULL;
+}
+
+unsigned int
+mupdf_document_search(fz_context* ctx, zathura_document_t* document,
+    mupdf_document_t* mupdf_document, const char* text, fz_cookie* cookie,
+    mupdf_search_callback_t callback, void* data)
+{
+  unsigned int n_pages = zathura_document_get_number_of_pages(document);
+  unsigned int i       = 0;
+
+  cookie->progress     = 0;
+  cookie->progress_max = n_pages;
+
+  for (; i < n_pages && cookie->abort == 0; i++) {
+    zathura_page_t* page     = zathura_document_get_page(document, i);
+    mupdf_page_t* mupdf_page = (page != NULL) ? zathura_page_get_data(page) : NULL;
+    if (mupdf_page == NULL) {
+      break;
+    }
+
+    girara_list_t* hits = mupdf_page_search_quads(ctx, mupdf_document,
+        mupdf_page, text, cookie);
+    if (hits == NULL) {
+      break;
+    }
+
+    /* the hits of an interrupted page are incomplete */
+    if (cookie->abort != 0) {
+      girara_list_free(hits);
+      break;
+    }
+
+    /* the interpreter counts operators in the cookie, the progress is
+     * restored to pages after each page */
+    cookie->progress     = i + 1;
+    cookie->progress_max = n_pages;
+    callback(i, n_pages, hits, data);
+  }
+
+  return i;
+}
+
+zathura_error_t
+pdf_document_search_text(zathura_document_t* document,
+    mupdf_document_t* mupdf_document, const char* text, fz_cookie* cookie,
+    mupdf_search_callback_t callback, void* data)
+{
+  if (document == NULL || mupdf_document == NULL || text == NULL || callback == NULL) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  /* the job belongs to the first page, which every search starts with */
+  zathura_page_t* page = zathura_document_get_page(document, 0);
+  if (page == NULL) {
+    callback(0, 0, NULL, data);
+    return ZATHURA_ERROR_OK;
+  }
+
+  if (mupdf_scheduler_push_search(mupdf_document->scheduler, page, text,
+        cookie, callback, data) == false) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  return ZATHURA_ERROR_OK;
+}
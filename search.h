@@ -0,0 +1,27 @@
+/* See LICENSE file for license and copyright information */
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "plugin.h"
+
+/**
+ * Searches all pages of the document in order on the calling thread and
+ * reports the hits of every completely searched page, see
+ * pdf_document_search_text
+ *
+ * @param ctx Context of the calling thread
+ * @param document Zathura document
+ * @param mupdf_document Document
+ * @param text Search item
+ * @param cookie Cookie used to abort the search; its progress and
+ *   progress_max fields count the searched pages
+ * @param callback Called with the hits of every completely searched page
+ * @param data Custom data passed to callback
+ * @return Number of completely searched pages
+ */
+unsigned int mupdf_document_search(fz_context* ctx, zathura_document_t* document,
+    mupdf_document_t* mupdf_document, const char* text, fz_cookie* cookie,
+    mupdf_search_callback_t callback, void* data);
+
+#endif // SEARCH_H
@@ -5,6 +5,7 @@
 #include <mupdf/pdf.h>
 
 #include "plugin.h"
+#include "match.h"
 #include "utils.h"
 
 char*
@@ -19,14 +20,152 @@ pdf_page_get_text(zathura_page_t* page, mupdf_page_t* mupdf_page, zathura_rectan
 
   zathura_document_t* document     = zathura_page_get_document(page);
   mupdf_document_t* mupdf_document = zathura_document_get_data(document);
-
-  if (mupdf_page->extracted_text == false) {
-    mupdf_page_extract_text(mupdf_document, mupdf_page);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    goto error_ret;
   }
 
+  mupdf_page_extract_text(ctx, mupdf_document, mupdf_page, NULL);
+
   fz_rect rect = { rectangle.x1, rectangle.y1, rectangle.x2, rectangle.y2 };
 
-  return fz_copy_selection(mupdf_page->ctx, mupdf_page->text, rect);
+  g_mutex_lock(&mupdf_document->mutex);
+  char* selection = fz_copy_selection(ctx, mupdf_page->text, rect);
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  return selection;
+
+error_ret:
+
+  if (error != NULL && *error == ZATHURA_ERROR_OK) {
+    *error = ZATHURA_ERROR_UNKNOWN;
+  }
+
+  return NULL;
+}
+
+static gint
+mupdf_text_request_compare(gconstpointer a, gconstpointer b, gpointer data)
+{
+  const mupdf_text_request_t* requests = data;
+  unsigned int page_a                  = requests[*(const unsigned int*) a].page;
+  unsigned int page_b                  = requests[*(const unsigned int*) b].page;
+
+  return (page_a > page_b) - (page_a < page_b);
+}
+
+zathura_error_t
+pdf_document_get_text_batch(zathura_document_t* document,
+    mupdf_document_t* mupdf_document, mupdf_text_request_t* requests,
+    unsigned int n_requests)
+{
+  if (document == NULL || mupdf_document == NULL || (requests == NULL && n_requests > 0)) {
+    return ZATHURA_ERROR_INVALID_ARGUMENTS;
+  }
+
+  fz_context* ctx = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    return ZATHURA_ERROR_UNKNOWN;
+  }
+
+  zathura_error_t error = ZATHURA_ERROR_OK;
+  unsigned int n_pages  = zathura_document_get_number_of_pages(document);
+  unsigned int* order   = g_new(unsigned int, n_requests);
+  fz_rect* rects        = g_new(fz_rect, n_requests);
+  GString** texts       = g_new(GString*, n_requests);
+
+  for (unsigned int i = 0; i < n_requests; i++) {
+    order[i]         = i;
+    requests[i].text = NULL;
+  }
+
+  /* visit every page once, in page order */
+  g_qsort_with_data(order, n_requests, sizeof(unsigned int),
+      mupdf_text_request_compare, requests);
+
+  for (unsigned int start = 0; start < n_requests;) {
+    unsigned int index = requests[order[start]].page;
+    unsigned int end   = start;
+
+    for (; end < n_requests && requests[order[end]].page == index; end++) {
+      zathura_rectangle_t* rectangle = &requests[order[end]].rectangle;
+      fz_rect rect                   = { rectangle->x1, rectangle->y1, rectangle->x2, rectangle->y2 };
+
+      rects[end - start] = rect;
+      texts[end - start] = g_string_new(NULL);
+    }
+
+    zathura_page_t* page     = (index < n_pages) ? zathura_document_get_page(document, index) : NULL;
+    mupdf_page_t* mupdf_page = (page != NULL) ? zathura_page_get_data(page) : NULL;
+
+    if (mupdf_page == NULL || mupdf_page->text == NULL) {
+      error = ZATHURA_ERROR_INVALID_ARGUMENTS;
+    } else {
+      mupdf_page_extract_text(ctx, mupdf_document, mupdf_page, NULL);
+
+      g_mutex_lock(&mupdf_document->mutex);
+      mupdf_copy_stext_selections(ctx, mupdf_page->text, rects,
+          texts, end - start);
+      g_mutex_unlock(&mupdf_document->mutex);
+    }
+
+    for (unsigned int i = start; i < end; i++) {
+      requests[order[i]].text = g_string_free(texts[i - start], FALSE);
+    }
+
+    start = end;
+  }
+
+  g_free(texts);
+  g_free(rects);
+  g_free(order);
+
+  return error;
+}
+
+girara_list_t*
+pdf_page_get_selection_quads(zathura_page_t* page, mupdf_page_t* mupdf_page,
+    zathura_rectangle_t rectangle, zathura_error_t* error)
+{
+  if (page == NULL || mupdf_page == NULL || mupdf_page->text == NULL) {
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_INVALID_ARGUMENTS;
+    }
+    goto error_ret;
+  }
+
+  zathura_document_t* document     = zathura_page_get_document(page);
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    goto error_ret;
+  }
+
+  girara_list_t* list = girara_list_new2(g_free);
+  if (list == NULL) {
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_OUT_OF_MEMORY;
+    }
+    goto error_ret;
+  }
+
+  mupdf_page_extract_text(ctx, mupdf_document, mupdf_page, NULL);
+
+  fz_rect rect  = { rectangle.x1, rectangle.y1, rectangle.x2, rectangle.y2 };
+  GArray* quads = g_array_new(FALSE, FALSE, sizeof(mupdf_quad_t));
+
+  g_mutex_lock(&mupdf_document->mutex);
+  mupdf_select_stext_quads(ctx, mupdf_page->text, &rect, quads);
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  for (unsigned int i = 0; i < quads->len; i++) {
+    girara_list_append(list, g_memdup(&g_array_index(quads, mupdf_quad_t, i),
+          sizeof(mupdf_quad_t)));
+  }
+
+  g_array_free(quads, TRUE);
+
+  return list;
 
 error_ret:
 
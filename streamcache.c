@@ -0,0 +1,196 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <glib.h>
+#include <mupdf/pdf.h>
+
+#include "streamcache.h"
+
+typedef struct mupdf_stream_entry_s
+{
+  int num; /**< Object number of the stream */
+  fz_buffer* buffer; /**< Decrypted, still encoded stream data */
+  size_t size; /**< Size of the data */
+} mupdf_stream_entry_t;
+
+/* MuPDF reads a stream from its xref entry's buffer instead of the file if
+ * one is set, and only applies the stream's filters to it. Installing the
+ * decrypted raw data there skips decryption without touching the
+ * interpreter. */
+struct mupdf_stream_cache_s
+{
+  GHashTable* entries; /**< Object number to link in queue */
+  GQueue queue; /**< Entries, most recently used first */
+  size_t size; /**< Total size of the cached data */
+};
+
+static void
+mupdf_stream_entry_evict(fz_context* ctx, pdf_document* document,
+    mupdf_stream_entry_t* entry)
+{
+  /* the entry may have been replaced by an edit in the meantime */
+  fz_try (ctx) {
+    pdf_xref_entry* x = pdf_get_xref_entry(ctx, document, entry->num);
+    if (x != NULL && x->stm_buf == entry->buffer) {
+      fz_drop_buffer(ctx, x->stm_buf);
+      x->stm_buf = NULL;
+    }
+  } fz_catch (ctx) {
+  }
+
+  fz_drop_buffer(ctx, entry->buffer);
+  g_free(entry);
+}
+
+mupdf_stream_cache_t*
+mupdf_stream_cache_new(fz_context* ctx, fz_document* document)
+{
+  pdf_document* pdf = pdf_specifics(ctx, document);
+  if (pdf == NULL || pdf->crypt == NULL) {
+    return NULL;
+  }
+
+  mupdf_stream_cache_t* cache = g_malloc0(sizeof(mupdf_stream_cache_t));
+  cache->entries = g_hash_table_new(g_direct_hash, g_direct_equal);
+  g_queue_init(&cache->queue);
+
+  return cache;
+}
+
+void
+mupdf_stream_cache_free(fz_context* ctx, fz_document* document,
+    mupdf_stream_cache_t* cache)
+{
+  if (cache == NULL) {
+    return;
+  }
+
+  pdf_document* pdf = pdf_specifics(ctx, document);
+
+  mupdf_stream_entry_t* entry = NULL;
+  while ((entry = g_queue_pop_head(&cache->queue)) != NULL) {
+    mupdf_stream_entry_evict(ctx, pdf, entry);
+  }
+
+  g_hash_table_destroy(cache->entries);
+  g_free(cache);
+}
+
+static bool
+mupdf_stream_has_crypt_filter(fz_context* ctx, pdf_obj* stream)
+{
+  pdf_obj* filter = pdf_dict_get(ctx, stream, PDF_NAME_Filter);
+  if (pdf_name_eq(ctx, filter, PDF_NAME_Crypt)) {
+    return true;
+  }
+
+  int n = pdf_array_len(ctx, filter);
+  for (int i = 0; i < n; i++) {
+    if (pdf_name_eq(ctx, pdf_array_get(ctx, filter, i), PDF_NAME_Crypt)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void
+mupdf_stream_cache_install(fz_context* ctx, pdf_document* document,
+    mupdf_stream_cache_t* cache, pdf_obj* stream)
+{
+  if (pdf_is_indirect(ctx, stream) == 0 || pdf_is_stream(ctx, stream) == 0) {
+    return;
+  }
+
+  int num     = pdf_to_num(ctx, stream);
+  GList* link = g_hash_table_lookup(cache->entries, GINT_TO_POINTER(num));
+  if (link != NULL) {
+    g_queue_unlink(&cache->queue, link);
+    g_queue_push_head_link(&cache->queue, link);
+    return;
+  }
+
+  /* streams with their own crypt filter, or already held in memory */
+  if (mupdf_stream_has_crypt_filter(ctx, stream) == true) {
+    return;
+  }
+
+  pdf_xref_entry* x = pdf_get_xref_entry(ctx, document, num);
+  if (x == NULL || x->stm_buf != NULL) {
+    return;
+  }
+
+  fz_buffer* buffer = pdf_load_raw_stream(ctx, document, num, pdf_to_gen(ctx, stream));
+
+  x          = pdf_get_xref_entry(ctx, document, num);
+  x->stm_buf = fz_keep_buffer(ctx, buffer);
+
+  mupdf_stream_entry_t* entry = g_malloc0(sizeof(mupdf_stream_entry_t));
+  entry->num    = num;
+  entry->buffer = buffer;
+  entry->size   = fz_buffer_storage(ctx, buffer, NULL);
+
+  g_queue_push_head(&cache->queue, entry);
+  g_hash_table_insert(cache->entries, GINT_TO_POINTER(num), cache->queue.head);
+  cache->size += entry->size;
+
+  while (cache->size > MUPDF_STREAM_CACHE_SIZE && g_queue_get_length(&cache->queue) > 1) {
+    mupdf_stream_entry_t* oldest = g_queue_pop_tail(&cache->queue);
+    g_hash_table_remove(cache->entries, GINT_TO_POINTER(oldest->num));
+    cache->size -= oldest->size;
+    mupdf_stream_entry_evict(ctx, document, oldest);
+  }
+}
+
+static void
+mupdf_stream_cache_install_font(fz_context* ctx, pdf_document* document,
+    mupdf_stream_cache_t* cache, pdf_obj* font)
+{
+  pdf_obj* descendants = pdf_dict_get(ctx, font, PDF_NAME_DescendantFonts);
+  if (pdf_array_len(ctx, descendants) > 0) {
+    font = pdf_array_get(ctx, descendants, 0);
+  }
+
+  pdf_obj* descriptor = pdf_dict_get(ctx, font, PDF_NAME_FontDescriptor);
+  if (descriptor == NULL) {
+    return;
+  }
+
+  mupdf_stream_cache_install(ctx, document, cache, pdf_dict_get(ctx, descriptor, PDF_NAME_FontFile));
+  mupdf_stream_cache_install(ctx, document, cache, pdf_dict_get(ctx, descriptor, PDF_NAME_FontFile2));
+  mupdf_stream_cache_install(ctx, document, cache, pdf_dict_get(ctx, descriptor, PDF_NAME_FontFile3));
+}
+
+void
+mupdf_stream_cache_prepare(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page)
+{
+  mupdf_stream_cache_t* cache = mupdf_document->stream_cache;
+  if (cache == NULL || mupdf_page->page == NULL) {
+    return;
+  }
+
+  pdf_document* document = pdf_specifics(ctx, mupdf_document->document);
+  pdf_page* page         = (pdf_page*) mupdf_page->page;
+
+  fz_try (ctx) {
+    pdf_obj* contents = page->contents;
+    if (pdf_is_array(ctx, contents)) {
+      int n = pdf_array_len(ctx, contents);
+      for (int i = 0; i < n; i++) {
+        mupdf_stream_cache_install(ctx, document, cache, pdf_array_get(ctx, contents, i));
+      }
+    } else {
+      mupdf_stream_cache_install(ctx, document, cache, contents);
+    }
+
+    pdf_obj* fonts = pdf_dict_get(ctx, page->resources, PDF_NAME_Font);
+    int n          = pdf_dict_len(ctx, fonts);
+    for (int i = 0; i < n; i++) {
+      mupdf_stream_cache_install_font(ctx, document, cache, pdf_dict_get_val(ctx, fonts, i));
+    }
+  } fz_catch (ctx) {
+    /* streams that could not be loaded are read from the file as before */
+  }
+}
@@ -0,0 +1,43 @@
+/* See LICENSE file for license and copyright information */
+
+#ifndef STREAMCACHE_H
+#define STREAMCACHE_H
+
+#include "plugin.h"
+
+/** Maximum number of decrypted bytes kept by the stream cache */
+#define MUPDF_STREAM_CACHE_SIZE (32 * 1024 * 1024)
+
+/**
+ * Creates the decrypted stream cache of an encrypted PDF document
+ *
+ * @param ctx Context
+ * @param document The document
+ * @return The cache or NULL if the document is not encrypted
+ */
+mupdf_stream_cache_t* mupdf_stream_cache_new(fz_context* ctx, fz_document* document);
+
+/**
+ * Frees the cache and hands the decrypted streams back to the document. Has
+ * to be called before the document is dropped.
+ *
+ * @param ctx Context
+ * @param document The document
+ * @param cache The cache
+ */
+void mupdf_stream_cache_free(fz_context* ctx, fz_document* document,
+    mupdf_stream_cache_t* cache);
+
+/**
+ * Decrypts the content streams of the page and the embedded fonts of its
+ * resources once and keeps them in memory, so that later interpretations
+ * only decompress them. Has to be called with the document mutex held.
+ *
+ * @param ctx Context of the calling thread
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ */
+void mupdf_stream_cache_prepare(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page);
+
+#endif // STREAMCACHE_H
@@ -0,0 +1,223 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "plugin.h"
+
+/* Bytes after every image buffer which rendering must not touch */
+#define GUARD_SIZE 64
+#define GUARD_BYTE 0xA5
+
+/* The test page is 100x100 points, its left half is red */
+#define PAGE_SIZE 100
+
+/* Minimal implementation of the zathura functions the plugin calls */
+
+struct zathura_document_s
+{
+  const char* path;
+  void* data;
+  double scale;
+  unsigned int n_pages;
+  zathura_page_t* page;
+};
+
+struct zathura_page_s
+{
+  zathura_document_t* document;
+  void* data;
+  double width;
+  double height;
+};
+
+zathura_image_buffer_t*
+zathura_image_buffer_create(unsigned int width, unsigned int height)
+{
+  zathura_image_buffer_t* buffer = g_malloc0(sizeof(zathura_image_buffer_t));
+  buffer->width                  = width;
+  buffer->height                 = height;
+  buffer->rowstride              = width * 3;
+  buffer->data                   = g_malloc((gsize) buffer->rowstride * height + GUARD_SIZE);
+  memset(buffer->data + (gsize) buffer->rowstride * height, GUARD_BYTE, GUARD_SIZE);
+
+  return buffer;
+}
+
+void
+zathura_image_buffer_free(zathura_image_buffer_t* buffer)
+{
+  if (buffer != NULL) {
+    g_free(buffer->data);
+    g_free(buffer);
+  }
+}
+
+zathura_document_t* zathura_page_get_document(zathura_page_t* page) { return page->document; }
+void* zathura_page_get_data(zathura_page_t* page) { return page->data; }
+void zathura_page_set_data(zathura_page_t* page, void* data) { page->data = data; }
+double zathura_page_get_width(zathura_page_t* page) { return page->width; }
+void zathura_page_set_width(zathura_page_t* page, double width) { page->width = width; }
+double zathura_page_get_height(zathura_page_t* page) { return page->height; }
+void zathura_page_set_height(zathura_page_t* page, double height) { page->height = height; }
+unsigned int zathura_page_get_index(zathura_page_t* GIRARA_UNUSED(page)) { return 0; }
+
+void* zathura_document_get_data(zathura_document_t* document) { return document->data; }
+void zathura_document_set_data(zathura_document_t* document, void* data) { document->data = data; }
+const char* zathura_document_get_path(zathura_document_t* document) { return document->path; }
+const char* zathura_document_get_password(zathura_document_t* GIRARA_UNUSED(document)) { return NULL; }
+double zathura_document_get_scale(zathura_document_t* document) { return document->scale; }
+unsigned int zathura_document_get_number_of_pages(zathura_document_t* document) { return document->n_pages; }
+void zathura_document_set_number_of_pages(zathura_document_t* document, unsigned int n_pages) { document->n_pages = n_pages; }
+
+zathura_page_t*
+zathura_document_get_page(zathura_document_t* document, unsigned int index)
+{
+  return (index == 0) ? document->page : NULL;
+}
+
+/* Not reached by rendering */
+zathura_link_t* zathura_link_new(zathura_link_type_t GIRARA_UNUSED(type),
+    zathura_rectangle_t GIRARA_UNUSED(position),
+    zathura_link_target_t GIRARA_UNUSED(target)) { return NULL; }
+zathura_index_element_t* zathura_index_element_new(const char* GIRARA_UNUSED(title)) { return NULL; }
+zathura_document_information_entry_t* zathura_document_information_entry_new(
+    zathura_document_information_type_t GIRARA_UNUSED(type),
+    const char* GIRARA_UNUSED(value)) { return NULL; }
+girara_list_t* zathura_document_information_entry_list_new(void) { return NULL; }
+
+/* Writes a one page PDF with a red rectangle over the left half */
+static char*
+write_document(void)
+{
+  const char* contents = "1 0 0 rg 0 0 50 100 re f\n";
+  char* objects[] = {
+    g_strdup("<< /Type /Catalog /Pages 2 0 R >>"),
+    g_strdup("<< /Type /Pages /Kids [3 0 R] /Count 1 >>"),
+    g_strdup("<< /Type /Page /Parent 2 0 R /MediaBox [0 0 100 100] /Contents 4 0 R >>"),
+    g_strdup_printf("<< /Length %zu >>\nstream\n%sendstream", strlen(contents), contents)
+  };
+  const unsigned int n_objects = sizeof(objects) / sizeof(objects[0]);
+
+  GString* pdf = g_string_new("%PDF-1.4\n");
+  gsize offsets[sizeof(objects) / sizeof(objects[0])];
+  for (unsigned int i = 0; i < n_objects; i++) {
+    offsets[i] = pdf->len;
+    g_string_append_printf(pdf, "%u 0 obj\n%s\nendobj\n", i + 1, objects[i]);
+    g_free(objects[i]);
+  }
+
+  gsize xref = pdf->len;
+  g_string_append_printf(pdf, "xref\n0 %u\n0000000000 65535 f \n", n_objects + 1);
+  for (unsigned int i = 0; i < n_objects; i++) {
+    g_string_append_printf(pdf, "%010zu 00000 n \n", offsets[i]);
+  }
+  g_string_append_printf(pdf, "trailer\n<< /Size %u /Root 1 0 R >>\nstartxref\n%zu\n%%%%EOF\n",
+      n_objects + 1, xref);
+
+  char* path = NULL;
+  int fd     = g_file_open_tmp("zathura-pdf-mupdf-XXXXXX.pdf", &path, NULL);
+  if (fd == -1 || write(fd, pdf->str, pdf->len) != (ssize_t) pdf->len) {
+    g_free(path);
+    path = NULL;
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+
+  g_string_free(pdf, TRUE);
+
+  return path;
+}
+
+static bool
+check_buffer(const char* name, zathura_image_buffer_t* buffer)
+{
+  if (buffer == NULL) {
+    fprintf(stderr, "%s: no image\n", name);
+    return false;
+  }
+
+  const unsigned char* guard = buffer->data + (gsize) buffer->rowstride * buffer->height;
+  for (unsigned int i = 0; i < GUARD_SIZE; i++) {
+    if (guard[i] != GUARD_BYTE) {
+      fprintf(stderr, "%s: rendering wrote past the end of the image\n", name);
+      return false;
+    }
+  }
+
+  /* probe the middle of each half, away from the anti-aliased edge */
+  unsigned int y               = buffer->height / 2;
+  const unsigned char* left    = buffer->data + y * buffer->rowstride + 3 * (buffer->width / 4);
+  const unsigned char* right   = buffer->data + y * buffer->rowstride + 3 * (3 * buffer->width / 4);
+  const unsigned char red[3]   = { 0xFF, 0x00, 0x00 };
+  const unsigned char white[3] = { 0xFF, 0xFF, 0xFF };
+  if (memcmp(left, red, 3) != 0 || memcmp(right, white, 3) != 0) {
+    fprintf(stderr, "%s: expected red and white RGB pixels, got %02x%02x%02x and %02x%02x%02x\n",
+        name, left[0], left[1], left[2], right[0], right[1], right[2]);
+    return false;
+  }
+
+  return true;
+}
+
+int
+main(void)
+{
+  char* path = write_document();
+  if (path == NULL) {
+    fprintf(stderr, "could not write the test document\n");
+    return EXIT_FAILURE;
+  }
+
+  zathura_document_t document = { .path = path, .scale = 1.0 };
+  zathura_page_t page         = { .document = &document };
+  document.page               = &page;
+
+  bool passed = false;
+  if (pdf_document_open(&document) != ZATHURA_ERROR_OK) {
+    fprintf(stderr, "could not open the test document\n");
+    goto error_free;
+  }
+
+  /* a failed initialization frees the page data itself */
+  if (pdf_page_init(&page) != ZATHURA_ERROR_OK) {
+    page.data = NULL;
+    fprintf(stderr, "could not load the page of the test document\n");
+    goto error_free;
+  }
+
+  if (page.width != PAGE_SIZE || page.height != PAGE_SIZE) {
+    fprintf(stderr, "unexpected page size %gx%g\n", page.width, page.height);
+    goto error_free;
+  }
+
+  zathura_error_t error          = ZATHURA_ERROR_OK;
+  zathura_image_buffer_t* buffer = pdf_page_render(&page, page.data, &error);
+  passed = check_buffer("pdf_page_render", buffer);
+  zathura_image_buffer_free(buffer);
+
+  /* an odd width makes sure RGB rows are not laid out like BGRA rows */
+  buffer = pdf_page_render_scaled(&page, page.data, 0.37, 1.51, &error);
+  passed = check_buffer("pdf_page_render_scaled", buffer) && passed;
+  zathura_image_buffer_free(buffer);
+
+error_free:
+
+  if (page.data != NULL) {
+    pdf_page_clear(&page, page.data);
+  }
+  if (document.data != NULL) {
+    pdf_document_free(&document, document.data);
+  }
+
+  unlink(path);
+  g_free(path);
+
+  return (passed == true) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,216 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <string.h>
+#include <glib.h>
+#include <mupdf/pdf.h>
+
+#include "plugin.h"
+#include "utils.h"
+
+/* An embedded thumbnail is used if it has to be enlarged by at most this
+ * factor */
+#define MUPDF_THUMBNAIL_MAX_UPSCALE 1.25
+
+/* Anti-aliasing level used for rendered thumbnails */
+#define MUPDF_THUMBNAIL_AA_LEVEL 1
+
+static zathura_image_buffer_t*
+mupdf_thumbnail_from_pixmap(fz_context* ctx, fz_pixmap* pixmap)
+{
+  unsigned int width  = fz_pixmap_width(ctx, pixmap);
+  unsigned int height = fz_pixmap_height(ctx, pixmap);
+
+  zathura_image_buffer_t* image_buffer = zathura_image_buffer_create(width, height);
+  if (image_buffer == NULL) {
+    return NULL;
+  }
+
+  unsigned char* samples = fz_pixmap_samples(ctx, pixmap);
+  unsigned int n         = fz_pixmap_components(ctx, pixmap);
+
+  for (unsigned int y = 0; y < height; y++) {
+    unsigned char* s = samples + y * width * n;
+    unsigned char* p = image_buffer->data + y * image_buffer->rowstride;
+    for (unsigned int x = 0; x < width; x++) {
+      p[0] = s[0];
+      p[1] = s[1];
+      p[2] = s[2];
+      p += 3;
+      s += n;
+    }
+  }
+
+  return image_buffer;
+}
+
+static fz_pixmap*
+mupdf_thumbnail_load_embedded(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, unsigned int width, unsigned int height)
+{
+  pdf_document* document = pdf_specifics(ctx, mupdf_document->document);
+  if (document == NULL) {
+    return NULL;
+  }
+
+  pdf_page* page    = (pdf_page*) mupdf_page->page;
+  fz_image* image   = NULL;
+  fz_pixmap* pixmap = NULL;
+  fz_pixmap* scaled = NULL;
+  fz_pixmap* fitted = NULL;
+  fz_pixmap* rgb    = NULL;
+
+  fz_var(image);
+  fz_var(pixmap);
+  fz_var(scaled);
+  fz_var(fitted);
+  fz_var(rgb);
+
+  g_mutex_lock(&mupdf_document->mutex);
+
+  fz_try (ctx) {
+    pdf_obj* thumb = pdf_dict_get(ctx, page->me, PDF_NAME_Thumb);
+    if (thumb != NULL) {
+      image = pdf_load_image(ctx, document, thumb);
+    }
+  } fz_catch (ctx) {
+    image = NULL;
+  }
+
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  if (image == NULL) {
+    return NULL;
+  }
+
+  /* the embedded image may have another aspect ratio than the page, it is
+   * fitted inside and centered on white */
+  double fit                = MIN((double) width / image->w, (double) height / image->h);
+  unsigned int image_width  = MAX(1, image->w * fit);
+  unsigned int image_height = MAX(1, image->h * fit);
+
+  fz_try (ctx) {
+    if (fit <= MUPDF_THUMBNAIL_MAX_UPSCALE) {
+      pixmap = fz_get_pixmap_from_image(ctx, image, NULL, NULL, NULL, NULL);
+
+      fz_pixmap* source = pixmap;
+      if ((unsigned int) fz_pixmap_width(ctx, pixmap) != image_width ||
+          (unsigned int) fz_pixmap_height(ctx, pixmap) != image_height) {
+        scaled = fz_scale_pixmap(ctx, pixmap, 0, 0, image_width, image_height, NULL);
+        source = scaled;
+      }
+
+      fitted = fz_new_pixmap(ctx, fz_device_rgb(ctx), image_width, image_height, 0);
+      fz_convert_pixmap(ctx, fitted, source);
+      fitted->x = (width - image_width) / 2;
+      fitted->y = (height - image_height) / 2;
+
+      fz_irect bounds = { .x1 = width, .y1 = height };
+      rgb = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), &bounds, 0);
+      fz_clear_pixmap_with_value(ctx, rgb, 0xFF);
+      fz_copy_pixmap_rect(ctx, rgb, fitted, &bounds);
+    }
+  } fz_always (ctx) {
+    fz_drop_pixmap(ctx, fitted);
+    fz_drop_pixmap(ctx, scaled);
+    fz_drop_pixmap(ctx, pixmap);
+    fz_drop_image(ctx, image);
+  } fz_catch (ctx) {
+    fz_drop_pixmap(ctx, rgb);
+    rgb = NULL;
+  }
+
+  return rgb;
+}
+
+static fz_pixmap*
+mupdf_thumbnail_render(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, unsigned int width, unsigned int height,
+    double scale)
+{
+  fz_pixmap* pixmap = NULL;
+  fz_device* device = NULL;
+  int aa_level      = fz_aa_level(ctx);
+
+  fz_var(pixmap);
+  fz_var(device);
+
+  fz_try (ctx) {
+    fz_irect irect = { .x1 = width, .y1 = height };
+    fz_rect rect   = { .x1 = width, .y1 = height };
+    fz_matrix m;
+    fz_scale(&m, scale, scale);
+
+    pixmap = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), &irect, 0);
+    fz_clear_pixmap_with_value(ctx, pixmap, 0xFF);
+
+    fz_set_aa_level(ctx, MUPDF_THUMBNAIL_AA_LEVEL);
+    device = fz_new_draw_device(ctx, NULL, pixmap);
+    mupdf_page_run_display_lists(ctx, mupdf_document, mupdf_page, device, &m, &rect, NULL);
+    fz_close_device(ctx, device);
+  } fz_always (ctx) {
+    fz_set_aa_level(ctx, aa_level);
+    fz_drop_device(ctx, device);
+  } fz_catch (ctx) {
+    fz_drop_pixmap(ctx, pixmap);
+    pixmap = NULL;
+  }
+
+  return pixmap;
+}
+
+zathura_image_buffer_t*
+pdf_page_get_thumbnail(zathura_page_t* page, mupdf_page_t* mupdf_page,
+    unsigned int width, unsigned int height, zathura_error_t* error)
+{
+  if (page == NULL || mupdf_page == NULL || width == 0 || height == 0) {
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_INVALID_ARGUMENTS;
+    }
+    return NULL;
+  }
+
+  zathura_document_t* document = zathura_page_get_document(page);
+  if (document == NULL) {
+    return NULL;
+  }
+
+  mupdf_document_t* mupdf_document = zathura_document_get_data(document);
+  fz_context* ctx                  = mupdf_document_get_context(mupdf_document);
+  if (ctx == NULL) {
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_UNKNOWN;
+    }
+    return NULL;
+  }
+
+  /* fit the page into the requested size */
+  double scale = MIN(width / zathura_page_get_width(page),
+      height / zathura_page_get_height(page));
+  unsigned int thumbnail_width  = MAX(1, scale * zathura_page_get_width(page));
+  unsigned int thumbnail_height = MAX(1, scale * zathura_page_get_height(page));
+
+  fz_pixmap* pixmap = mupdf_thumbnail_load_embedded(ctx, mupdf_document,
+      mupdf_page, thumbnail_width, thumbnail_height);
+  if (pixmap == NULL) {
+    pixmap = mupdf_thumbnail_render(ctx, mupdf_document, mupdf_page,
+        thumbnail_width, thumbnail_height, scale);
+  }
+
+  if (pixmap == NULL) {
+    if (error != NULL) {
+      *error = ZATHURA_ERROR_UNKNOWN;
+    }
+    return NULL;
+  }
+
+  zathura_image_buffer_t* image_buffer = mupdf_thumbnail_from_pixmap(ctx, pixmap);
+  fz_drop_pixmap(ctx, pixmap);
+
+  if (image_buffer == NULL && error != NULL) {
+    *error = ZATHURA_ERROR_OUT_OF_MEMORY;
+  }
+
+  return image_buffer;
+}
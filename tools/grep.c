@@ -0,0 +1,233 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "export.h"
+#include "match.h"
+
+typedef struct grep_options_s
+{
+  const char* needle; /**< Text to search for */
+  const char* password; /**< Password for encrypted documents or NULL */
+  bool first; /**< Stop searching a document at its first hit */
+  bool files_only; /**< Only print the names of matching documents */
+} grep_options_t;
+
+static GMutex grep_output_mutex;
+static volatile gint grep_matches = 0;
+static volatile gint grep_errors  = 0;
+
+/* Each worker thread keeps its own context for all documents it processes */
+static GPrivate grep_context_key = G_PRIVATE_INIT((GDestroyNotify) fz_drop_context);
+
+static fz_context*
+grep_context(void)
+{
+  fz_context* ctx = g_private_get(&grep_context_key);
+  if (ctx == NULL) {
+    ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+    g_private_set(&grep_context_key, ctx);
+  }
+
+  return ctx;
+}
+
+static bool
+grep_page(fz_context* ctx, fz_document* document, int index,
+    const grep_options_t* options, const char* path, GString* output,
+    GArray* hits)
+{
+  fz_stext_sheet* sheet = NULL;
+  fz_stext_page* text   = NULL;
+  unsigned int n_hits   = 0;
+
+  fz_var(sheet);
+  fz_var(text);
+  fz_var(n_hits);
+
+  fz_try (ctx) {
+    sheet  = fz_new_stext_sheet(ctx);
+    text   = mupdf_export_extract_page(ctx, document, NULL, index, sheet, NULL);
+    n_hits = mupdf_search_stext_page(ctx, text, options->needle, hits, NULL);
+  } fz_always (ctx) {
+    fz_drop_stext_page(ctx, text);
+    fz_drop_stext_sheet(ctx, sheet);
+  } fz_catch (ctx) {
+    fprintf(stderr, "%s: page %d: %s\n", path, index + 1, fz_caught_message(ctx));
+    g_atomic_int_inc(&grep_errors);
+    return false;
+  }
+
+  if (options->files_only == true) {
+    return n_hits > 0;
+  }
+
+  if (options->first == true && n_hits > 1) {
+    n_hits = 1;
+  }
+
+  for (unsigned int i = 0; i < n_hits; i++) {
+    fz_rect* hit = &g_array_index(hits, fz_rect, i);
+    g_string_append_printf(output, "%s:%d: %g %g %g %g\n", path, index + 1,
+        hit->x0, hit->y0, hit->x1, hit->y1);
+  }
+
+  return n_hits > 0;
+}
+
+static void
+grep_document(gpointer data, gpointer user_data)
+{
+  char* path                    = data;
+  const grep_options_t* options = user_data;
+  fz_context* ctx               = grep_context();
+  fz_document* document         = NULL;
+  GString* output               = g_string_new(NULL);
+  GArray* hits                  = g_array_new(FALSE, FALSE, sizeof(fz_rect));
+  bool found                    = false;
+
+  fz_var(document);
+  fz_var(found);
+
+  if (ctx == NULL) {
+    g_atomic_int_inc(&grep_errors);
+    goto error_free;
+  }
+
+  fz_try (ctx) {
+    document    = mupdf_export_open_document(ctx, path, options->password);
+    int n_pages = fz_count_pages(ctx, document);
+
+    for (int i = 0; i < n_pages; i++) {
+      if (grep_page(ctx, document, i, options, path, output, hits) == true) {
+        found = true;
+        if (options->first == true || options->files_only == true) {
+          break;
+        }
+      }
+    }
+  } fz_always (ctx) {
+    fz_drop_document(ctx, document);
+  } fz_catch (ctx) {
+    fprintf(stderr, "%s: %s\n", path, fz_caught_message(ctx));
+    g_atomic_int_inc(&grep_errors);
+  }
+
+  if (found == true) {
+    g_atomic_int_inc(&grep_matches);
+    if (options->files_only == true) {
+      g_string_append_printf(output, "%s\n", path);
+    }
+
+    /* the hits of a document are printed in one piece */
+    g_mutex_lock(&grep_output_mutex);
+    fputs(output->str, stdout);
+    g_mutex_unlock(&grep_output_mutex);
+  }
+
+error_free:
+
+  g_array_free(hits, TRUE);
+  g_string_free(output, TRUE);
+  g_free(path);
+}
+
+/* Symbolic links to directories are only followed if given on the command
+ * line, so links pointing back up the tree cannot recurse forever */
+static void
+grep_walk(GThreadPool* pool, const char* path, bool explicit)
+{
+  if (g_file_test(path, G_FILE_TEST_IS_DIR) == TRUE) {
+    if (explicit == false && g_file_test(path, G_FILE_TEST_IS_SYMLINK) == TRUE) {
+      return;
+    }
+
+    GDir* dir = g_dir_open(path, 0, NULL);
+    if (dir == NULL) {
+      fprintf(stderr, "%s: cannot open directory\n", path);
+      g_atomic_int_inc(&grep_errors);
+      return;
+    }
+
+    const char* name = NULL;
+    while ((name = g_dir_read_name(dir)) != NULL) {
+      char* child = g_build_filename(path, name, NULL);
+      grep_walk(pool, child, false);
+      g_free(child);
+    }
+
+    g_dir_close(dir);
+    return;
+  }
+
+  /* inside directories only PDF files are searched */
+  if (explicit == true || g_str_has_suffix(path, ".pdf") == TRUE ||
+      g_str_has_suffix(path, ".PDF") == TRUE) {
+    g_thread_pool_push(pool, g_strdup(path), NULL);
+  }
+}
+
+int
+main(int argc, char* argv[])
+{
+  char* password = NULL;
+  gboolean first = FALSE;
+  gboolean files = FALSE;
+  int n_threads  = 0;
+
+  GOptionEntry entries[] = {
+    { "password", 'p', 0, G_OPTION_ARG_STRING, &password, "Password for encrypted documents", "PASSWORD" },
+    { "first", '1', 0, G_OPTION_ARG_NONE, &first, "Stop searching a document at its first hit", NULL },
+    { "files-with-matches", 'l', 0, G_OPTION_ARG_NONE, &files, "Only print the names of matching documents", NULL },
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &n_threads, "Number of documents searched in parallel, 0 for one per processor", "N" },
+    { NULL, 0, 0, 0, NULL, NULL, NULL }
+  };
+
+  GOptionContext* context = g_option_context_new("TEXT PATH... - search documents for a text");
+  g_option_context_add_main_entries(context, entries, NULL);
+
+  GError* gerror = NULL;
+  if (g_option_context_parse(context, &argc, &argv, &gerror) == FALSE || argc < 3) {
+    fprintf(stderr, "%s\n", (gerror != NULL) ? gerror->message : "a text and at least one path expected");
+    g_clear_error(&gerror);
+    g_option_context_free(context);
+    return 2;
+  }
+  g_option_context_free(context);
+
+  if (n_threads <= 0) {
+    n_threads = g_get_num_processors();
+  }
+
+  grep_options_t options = {
+    .needle     = argv[1],
+    .password   = password,
+    .first      = (first == TRUE),
+    .files_only = (files == TRUE)
+  };
+
+  GThreadPool* pool = g_thread_pool_new(grep_document, &options, n_threads, TRUE, NULL);
+  if (pool == NULL) {
+    fprintf(stderr, "cannot create threads\n");
+    return 2;
+  }
+
+  for (int i = 2; i < argc; i++) {
+    grep_walk(pool, argv[i], true);
+  }
+
+  /* waits for all queued documents */
+  g_thread_pool_free(pool, FALSE, TRUE);
+  g_free(password);
+
+  if (grep_errors > 0) {
+    return 2;
+  }
+
+  return (grep_matches > 0) ? 0 : 1;
+}
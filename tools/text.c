@@ -0,0 +1,99 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "export.h"
+
+int
+main(int argc, char* argv[])
+{
+  char* password = NULL;
+  char* output   = NULL;
+  char* format   = NULL;
+  int n_threads  = 1;
+
+  GOptionEntry entries[] = {
+    { "password", 'p', 0, G_OPTION_ARG_STRING, &password, "Password of the document", "PASSWORD" },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Write the text to FILE instead of stdout", "FILE" },
+    { "format", 'f', 0, G_OPTION_ARG_STRING, &format, "Output format: text (default), json or binary", "FORMAT" },
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &n_threads, "Number of threads, 0 for one per processor", "N" },
+    { NULL, 0, 0, 0, NULL, NULL, NULL }
+  };
+
+  GOptionContext* options = g_option_context_new("DOCUMENT - extract the text of a document");
+  g_option_context_add_main_entries(options, entries, NULL);
+
+  GError* gerror = NULL;
+  if (g_option_context_parse(options, &argc, &argv, &gerror) == FALSE || argc != 2) {
+    fprintf(stderr, "%s\n", (gerror != NULL) ? gerror->message : "exactly one document expected");
+    g_clear_error(&gerror);
+    g_option_context_free(options);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free(options);
+
+  mupdf_export_format_t export_format = MUPDF_EXPORT_FORMAT_TEXT;
+  if (format == NULL || strcmp(format, "text") == 0) {
+    export_format = MUPDF_EXPORT_FORMAT_TEXT;
+  } else if (strcmp(format, "json") == 0) {
+    export_format = MUPDF_EXPORT_FORMAT_JSON;
+  } else if (strcmp(format, "binary") == 0) {
+    export_format = MUPDF_EXPORT_FORMAT_BINARY;
+  } else {
+    fprintf(stderr, "unknown format: %s\n", format);
+    return EXIT_FAILURE;
+  }
+
+  if (n_threads < 0) {
+    fprintf(stderr, "invalid number of jobs: %d\n", n_threads);
+    return EXIT_FAILURE;
+  }
+
+  int fd = STDOUT_FILENO;
+  if (output != NULL) {
+    fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) {
+      perror(output);
+      return EXIT_FAILURE;
+    }
+  }
+
+  fz_context* ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+  if (ctx == NULL) {
+    fprintf(stderr, "cannot create mupdf context\n");
+    return EXIT_FAILURE;
+  }
+
+  int status     = EXIT_FAILURE;
+  fz_output* out = mupdf_export_open_fd(ctx, fd);
+
+  if (out == NULL) {
+    fprintf(stderr, "cannot write output\n");
+  } else {
+    if (mupdf_export_file(ctx, argv[1], password, out, export_format,
+          n_threads) == ZATHURA_ERROR_OK) {
+      status = EXIT_SUCCESS;
+    } else {
+      fprintf(stderr, "%s: export failed\n", argv[1]);
+    }
+    fz_drop_output(ctx, out);
+  }
+
+  fz_drop_context(ctx);
+
+  if (output != NULL) {
+    close(fd);
+  }
+  g_free(output);
+  g_free(password);
+  g_free(format);
+
+  return status;
+}
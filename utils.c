@@ -2,31 +2,335 @@
 
 #define _POSIX_C_SOURCE 1
 
+#include "dedup.h"
+#include "layer.h"
+#include "pyramid.h"
+#include "streamcache.h"
 #include "utils.h"
+#include "xobject.h"
 
-void
-mupdf_page_extract_text(mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page) {
-  if (mupdf_document == NULL || mupdf_document->ctx == NULL || mupdf_page == NULL ||
+/* Interval in microseconds at which a busy document mutex is polled */
+#define MUPDF_LOCK_POLL_INTERVAL 1000
+
+bool
+mupdf_document_lock_abortable(mupdf_document_t* mupdf_document, fz_cookie* cookie)
+{
+  if (cookie == NULL) {
+    g_mutex_lock(&mupdf_document->mutex);
+    return true;
+  }
+
+  /* GMutex cannot be waited for with a timeout, so poll it until the cookie
+   * is aborted */
+  while (g_mutex_trylock(&mupdf_document->mutex) == FALSE) {
+    if (cookie->abort != 0) {
+      return false;
+    }
+    g_usleep(MUPDF_LOCK_POLL_INTERVAL);
+  }
+
+  return true;
+}
+
+bool
+mupdf_page_extract_text(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, fz_cookie* cookie)
+{
+  if (ctx == NULL || mupdf_document == NULL || mupdf_page == NULL ||
       mupdf_page->sheet == NULL || mupdf_page->text == NULL) {
-    return;
+    return false;
+  }
+
+  if (mupdf_document_lock_abortable(mupdf_document, cookie) == false) {
+    return false;
+  }
+
+  /* identical pages share their text, which another page may have replaced
+   * by its extraction */
+  mupdf_page_bind_shared(ctx, mupdf_document, mupdf_page);
+  if (mupdf_page->shared != NULL) {
+    mupdf_page->text = mupdf_page->shared->text;
+    if (mupdf_page->shared->extracted_text == true) {
+      mupdf_page->extracted_text = true;
+    }
+  }
+
+  if (mupdf_page->extracted_text == true) {
+    g_mutex_unlock(&mupdf_document->mutex);
+    return true;
   }
 
   fz_device* text_device = NULL;
+  fz_stext_page* text    = NULL;
 
-  fz_try (mupdf_page->ctx) {
-    text_device = fz_new_stext_device(mupdf_page->ctx, mupdf_page->sheet, mupdf_page->text, NULL);
+  fz_var(text_device);
+  fz_var(text);
+
+  fz_try (ctx) {
+    /* An aborted extraction must not leave a partial text behind, so it
+     * goes to a new page that replaces the empty one */
+    text = (cookie != NULL) ? fz_new_stext_page(ctx, &mupdf_page->bbox) : mupdf_page->text;
+    text_device = fz_new_stext_device(ctx, mupdf_page->sheet, text, NULL);
 
     /* Disable FZ_IGNORE_IMAGE to collect image blocks */
-    fz_disable_device_hints(mupdf_page->ctx, text_device, FZ_IGNORE_IMAGE);
+    fz_disable_device_hints(ctx, text_device, FZ_IGNORE_IMAGE);
+
+    mupdf_stream_cache_prepare(ctx, mupdf_document, mupdf_page);
 
     fz_matrix ctm;
     fz_scale(&ctm, 1.0, 1.0);
-    fz_run_page(mupdf_page->ctx, mupdf_page->page, text_device, &ctm, NULL);
-  } fz_always (mupdf_document->ctx) {
-    fz_close_device(mupdf_page->ctx, text_device);
-    fz_drop_device(mupdf_page->ctx, text_device);
-  } fz_catch(mupdf_document->ctx) {
+    fz_run_page(ctx, mupdf_page->page, text_device, &ctm, cookie);
+  } fz_always (ctx) {
+    fz_close_device(ctx, text_device);
+    fz_drop_device(ctx, text_device);
+  } fz_catch(ctx) {
+  }
+
+  bool aborted = (cookie != NULL && cookie->abort != 0);
+
+  if (text != NULL && text != mupdf_page->text) {
+    if (aborted == false) {
+      fz_stext_page* empty = mupdf_page->text;
+      mupdf_page->text     = text;
+      if (mupdf_page->shared != NULL) {
+        mupdf_page->shared->text = text;
+      }
+      text = empty;
+    }
+    fz_drop_stext_page(ctx, text);
+  }
+
+  if (aborted == false) {
+    mupdf_page->extracted_text = true;
+    if (mupdf_page->shared != NULL) {
+      mupdf_page->shared->extracted_text = true;
+    }
+  }
+
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  return !aborted;
+}
+
+fz_display_list*
+mupdf_page_get_display_list(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, fz_cookie* cookie)
+{
+  if (ctx == NULL || mupdf_document == NULL || mupdf_page == NULL ||
+      mupdf_page->page == NULL) {
+    return NULL;
+  }
+
+  if (mupdf_document_lock_abortable(mupdf_document, cookie) == false) {
+    return NULL;
+  }
+
+  mupdf_page_bind_shared(ctx, mupdf_document, mupdf_page);
+
+  /* lists recorded with other layers visible are of no use */
+  const char* state = mupdf_document->layer_state;
+  if (mupdf_page->display_list != NULL && mupdf_page->display_list_state != state) {
+    fz_drop_display_list(ctx, mupdf_page->display_list);
+    mupdf_page->display_list = NULL;
+  }
+
+  mupdf_shared_page_t* shared = mupdf_page->shared;
+  if (shared != NULL && shared->display_list != NULL && shared->display_list_state != state) {
+    fz_drop_display_list(ctx, shared->display_list);
+    shared->display_list = NULL;
+  }
+
+  if (mupdf_page->display_list == NULL && shared != NULL && shared->display_list != NULL) {
+    mupdf_page->display_list       = fz_keep_display_list(ctx, shared->display_list);
+    mupdf_page->display_list_state = state;
+  }
+
+  if (mupdf_page->display_list != NULL) {
+    fz_display_list* display_list = fz_keep_display_list(ctx, mupdf_page->display_list);
+    g_mutex_unlock(&mupdf_document->mutex);
+    return display_list;
+  }
+
+  fz_cookie local_cookie = { 0 };
+  if (cookie == NULL) {
+    cookie = &local_cookie;
+  }
+
+  fz_display_list* display_list = NULL;
+  fz_device* device             = NULL;
+  int progress                  = cookie->progress;
+  gint64 start                  = g_get_monotonic_time();
+
+  fz_var(display_list);
+  fz_var(device);
+
+  fz_try (ctx) {
+    mupdf_stream_cache_prepare(ctx, mupdf_document, mupdf_page);
+
+    display_list = fz_new_display_list(ctx, &mupdf_page->bbox);
+    device       = fz_new_list_device(ctx, display_list);
+    mupdf_page_run_contents(ctx, mupdf_document, mupdf_page, device, &fz_identity, cookie);
+    fz_close_device(ctx, device);
+  } fz_always (ctx) {
+    fz_drop_device(ctx, device);
+  } fz_catch (ctx) {
+    fz_drop_display_list(ctx, display_list);
+    display_list = NULL;
   }
 
-  mupdf_page->extracted_text = true;
+  /* Only complete recordings are worth keeping, an aborted one is still
+   * returned so that the caller can draw what has been recorded */
+  if (display_list != NULL && cookie->abort == 0) {
+    mupdf_page->display_list       = fz_keep_display_list(ctx, display_list);
+    mupdf_page->display_list_state = state;
+    mupdf_page->record_time        = g_get_monotonic_time() - start;
+    mupdf_page->complexity         = cookie->progress - progress;
+
+    if (shared != NULL && shared->display_list == NULL) {
+      shared->display_list       = fz_keep_display_list(ctx, display_list);
+      shared->display_list_state = state;
+    }
+  }
+
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  return display_list;
+}
+
+fz_display_list*
+mupdf_page_get_annotation_list(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, fz_cookie* cookie)
+{
+  if (ctx == NULL || mupdf_document == NULL || mupdf_page == NULL ||
+      mupdf_page->page == NULL) {
+    return NULL;
+  }
+
+  if (mupdf_document_lock_abortable(mupdf_document, cookie) == false) {
+    return NULL;
+  }
+
+  if (mupdf_document->hide_annotations == true) {
+    g_mutex_unlock(&mupdf_document->mutex);
+    return NULL;
+  }
+
+  /* annotations may belong to optional content groups as well */
+  if (mupdf_page->annotation_list_valid == true &&
+      mupdf_page->annotation_list_state == mupdf_document->layer_state) {
+    fz_display_list* display_list = NULL;
+    if (mupdf_page->annotation_list != NULL) {
+      display_list = fz_keep_display_list(ctx, mupdf_page->annotation_list);
+    }
+    g_mutex_unlock(&mupdf_document->mutex);
+    return display_list;
+  }
+
+  fz_display_list* display_list = NULL;
+  fz_device* device             = NULL;
+  bool valid                    = false;
+
+  fz_var(display_list);
+  fz_var(device);
+  fz_var(valid);
+
+  fz_try (ctx) {
+    fz_annot* annot = fz_first_annot(ctx, mupdf_page->page);
+    if (annot != NULL) {
+      display_list = fz_new_display_list(ctx, &mupdf_page->bbox);
+      device       = fz_new_list_device(ctx, display_list);
+      for (; annot != NULL; annot = fz_next_annot(ctx, annot)) {
+        fz_run_annot(ctx, annot, device, &fz_identity, cookie);
+      }
+      fz_close_device(ctx, device);
+    }
+    valid = (cookie == NULL || cookie->abort == 0);
+  } fz_always (ctx) {
+    fz_drop_device(ctx, device);
+  } fz_catch (ctx) {
+    fz_drop_display_list(ctx, display_list);
+    display_list = NULL;
+  }
+
+  /* pages without annotations are remembered as a valid empty layer */
+  if (valid == true) {
+    fz_drop_display_list(ctx, mupdf_page->annotation_list);
+    mupdf_page->annotation_list       = (display_list != NULL) ? fz_keep_display_list(ctx, display_list) : NULL;
+    mupdf_page->annotation_list_valid = true;
+    mupdf_page->annotation_list_state = mupdf_document->layer_state;
+  }
+
+  g_mutex_unlock(&mupdf_document->mutex);
+
+  return display_list;
+}
+
+void
+mupdf_page_run_display_lists(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, fz_device* device, const fz_matrix* ctm,
+    const fz_rect* scissor, fz_cookie* cookie)
+{
+  fz_display_list* display_list    = mupdf_page_get_display_list(ctx, mupdf_document, mupdf_page, cookie);
+  fz_display_list* annotation_list = NULL;
+
+  fz_var(annotation_list);
+
+  fz_try (ctx) {
+    if (display_list != NULL) {
+      fz_run_display_list(ctx, display_list, device, ctm, scissor, cookie);
+    }
+
+    annotation_list = mupdf_page_get_annotation_list(ctx, mupdf_document, mupdf_page, cookie);
+    if (annotation_list != NULL) {
+      fz_run_display_list(ctx, annotation_list, device, ctm, scissor, cookie);
+    }
+  } fz_always (ctx) {
+    fz_drop_display_list(ctx, annotation_list);
+    fz_drop_display_list(ctx, display_list);
+  } fz_catch (ctx) {
+    fz_rethrow(ctx);
+  }
+}
+
+void
+mupdf_document_drop_rasters(mupdf_document_t* mupdf_document)
+{
+  g_mutex_lock(&mupdf_document->mutex);
+
+  /* renders still in flight started before the change and must not store
+   * their rasters */
+  g_atomic_int_inc(&mupdf_document->raster_generation);
+
+  mupdf_pyramid_clear_all(mupdf_document);
+  mupdf_layer_clear_all(mupdf_document);
+  mupdf_shared_pages_clear_rasters(mupdf_document);
+
+  g_mutex_unlock(&mupdf_document->mutex);
+}
+
+unsigned int
+mupdf_document_raster_generation(mupdf_document_t* mupdf_document)
+{
+  /* read without the mutex so that a render never waits for it here */
+  return g_atomic_int_get(&mupdf_document->raster_generation);
+}
+
+fz_context*
+mupdf_document_get_context(mupdf_document_t* mupdf_document)
+{
+  GThread* thread = g_thread_self();
+
+  g_mutex_lock(&mupdf_document->context_mutex);
+
+  fz_context* ctx = g_hash_table_lookup(mupdf_document->thread_contexts, thread);
+  if (ctx == NULL) {
+    ctx = fz_clone_context(mupdf_document->ctx);
+    if (ctx != NULL) {
+      g_hash_table_insert(mupdf_document->thread_contexts, thread, ctx);
+    }
+  }
+
+  g_mutex_unlock(&mupdf_document->context_mutex);
+
+  return ctx;
 }
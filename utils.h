@@ -5,7 +5,113 @@
 
 #include "plugin.h"
 
-void mupdf_page_extract_text(mupdf_document_t* mupdf_document,
-    mupdf_page_t* mupdf_page);
+/**
+ * Locks the document mutex like g_mutex_lock, but gives up once the cookie
+ * has been aborted. A worker holds the mutex for a whole recording or
+ * extraction, so a render against a deadline uses this to stop waiting for
+ * it when the deadline passes.
+ *
+ * @param mupdf_document Document
+ * @param cookie Cookie of the caller or NULL to wait as long as it takes
+ * @return true if the mutex has been locked, false if the cookie has been
+ *   aborted first
+ */
+bool mupdf_document_lock_abortable(mupdf_document_t* mupdf_document,
+    fz_cookie* cookie);
+
+/**
+ * Extracts the text of the page unless it has been extracted already
+ *
+ * @param ctx Context of the calling thread
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ * @param cookie Cookie used to abort the extraction or NULL; an aborted
+ *   extraction leaves the page without text so it is extracted again later.
+ *   Waiting for the document mutex is aborted by it as well.
+ * @return true if the text of the page is available. Extractions replace
+ *   mupdf_page->text, so it is only read after calling this function and
+ *   with the document mutex held.
+ */
+bool mupdf_page_extract_text(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, fz_cookie* cookie);
+
+/**
+ * Returns the display list of the page's contents (without annotations),
+ * recording it first if it has not been cached yet. The list is recorded in
+ * page space, the caller applies the scale when running it.
+ *
+ * @param ctx Context of the calling thread
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ * @param cookie Cookie used to abort the recording or NULL
+ * @return A new reference to the display list (drop with
+ *   fz_drop_display_list) or NULL if an error occurred or the cookie was
+ *   aborted while waiting for the document mutex. An aborted recording is
+ *   returned as far as it got but not cached.
+ */
+fz_display_list* mupdf_page_get_display_list(fz_context* ctx,
+    mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+    fz_cookie* cookie);
+
+/**
+ * Returns the display list of the page's annotations and widgets, recording
+ * it first if it has not been cached yet
+ *
+ * @param ctx Context of the calling thread
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ * @param cookie Cookie used to abort the recording or NULL
+ * @return A new reference to the display list or NULL if the page has no
+ *   annotations, an error occurred or the recording (or waiting for the
+ *   document mutex) was aborted
+ */
+fz_display_list* mupdf_page_get_annotation_list(fz_context* ctx,
+    mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+    fz_cookie* cookie);
+
+/**
+ * Runs the content and the annotation layer of the page through a device
+ *
+ * @param ctx Context of the calling thread
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ * @param device Target device
+ * @param ctm Transformation
+ * @param scissor Area of interest in device space
+ * @param cookie Cookie used to abort the run or NULL
+ */
+void mupdf_page_run_display_lists(fz_context* ctx,
+    mupdf_document_t* mupdf_document, mupdf_page_t* mupdf_page,
+    fz_device* device, const fz_matrix* ctm, const fz_rect* scissor,
+    fz_cookie* cookie);
+
+/**
+ * Drops every raster the plugin keeps of the document's pages, e.g. because
+ * a setting affecting their appearance changed
+ *
+ * @param mupdf_document Document
+ */
+void mupdf_document_drop_rasters(mupdf_document_t* mupdf_document);
+
+/**
+ * Returns the current raster generation. Renders read it before they start
+ * and pass it to the raster stores, which discard rasters of an older
+ * generation. It is read without locking the document mutex.
+ *
+ * @param mupdf_document Document
+ * @return The generation
+ */
+unsigned int mupdf_document_raster_generation(mupdf_document_t* mupdf_document);
+
+/**
+ * Returns the context of the calling thread. Contexts must not be used by
+ * two threads at once, so every host thread calling into the plugin gets
+ * its own clone of the document's context, which is kept until the
+ * document is freed.
+ *
+ * @param mupdf_document Document
+ * @return The context or NULL if it could not be cloned
+ */
+fz_context* mupdf_document_get_context(mupdf_document_t* mupdf_document);
 
 #endif // UTILS_H
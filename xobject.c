@@ -0,0 +1,545 @@
+/* See LICENSE file for license and copyright information */
+
+#define _POSIX_C_SOURCE 1
+
+#include <string.h>
+#include <glib.h>
+#include <mupdf/pdf.h>
+
+#include "xobject.h"
+
+/* Depth of q/Q nesting that is tracked */
+#define MUPDF_FORM_MAX_GSTATES 64
+
+typedef struct mupdf_form_entry_s
+{
+  unsigned int uses; /**< Number of times the form has been drawn */
+  fz_display_list* display_list; /**< Recorded form, NULL until used twice */
+} mupdf_form_entry_t;
+
+/* Follows the graphics state of a run processor so that cached forms can be
+ * replayed at the right place */
+typedef struct mupdf_form_tracker_s
+{
+  mupdf_document_t* mupdf_document; /**< Document */
+  pdf_document* document; /**< PDF document */
+  fz_device* device; /**< Target device */
+  fz_cookie* cookie; /**< Cookie */
+  pdf_processor original; /**< Functions of the wrapped run processor */
+  fz_matrix ctm[MUPDF_FORM_MAX_GSTATES]; /**< CTM per q level */
+  bool dirty[MUPDF_FORM_MAX_GSTATES]; /**< If state other than the CTM differs from the default */
+  int top; /**< Current q level */
+  int nesting; /**< Depth of forms run by the wrapped processor */
+} mupdf_form_tracker_t;
+
+static GPrivate mupdf_form_tracker_key = G_PRIVATE_INIT(NULL);
+
+static mupdf_form_tracker_t*
+mupdf_form_tracker(void)
+{
+  return g_private_get(&mupdf_form_tracker_key);
+}
+
+static void
+mupdf_form_mark_dirty(void)
+{
+  mupdf_form_tracker_t* tracker = mupdf_form_tracker();
+  if (tracker->nesting == 0 && tracker->top < MUPDF_FORM_MAX_GSTATES) {
+    tracker->dirty[tracker->top] = true;
+  }
+}
+
+static void
+mupdf_form_op_q(fz_context* ctx, pdf_processor* proc)
+{
+  mupdf_form_tracker_t* tracker = mupdf_form_tracker();
+  if (tracker->nesting == 0) {
+    int top = tracker->top;
+    if (top + 1 < MUPDF_FORM_MAX_GSTATES) {
+      tracker->ctm[top + 1]   = tracker->ctm[top];
+      tracker->dirty[top + 1] = tracker->dirty[top];
+    }
+    tracker->top++;
+  }
+  tracker->original.op_q(ctx, proc);
+}
+
+static void
+mupdf_form_op_Q(fz_context* ctx, pdf_processor* proc)
+{
+  mupdf_form_tracker_t* tracker = mupdf_form_tracker();
+  if (tracker->nesting == 0 && tracker->top > 0) {
+    tracker->top--;
+  }
+  tracker->original.op_Q(ctx, proc);
+}
+
+static void
+mupdf_form_op_cm(fz_context* ctx, pdf_processor* proc, float a, float b,
+    float c, float d, float e, float f)
+{
+  mupdf_form_tracker_t* tracker = mupdf_form_tracker();
+  if (tracker->nesting == 0 && tracker->top < MUPDF_FORM_MAX_GSTATES) {
+    fz_matrix m = { a, b, c, d, e, f };
+    fz_concat(&tracker->ctm[tracker->top], &m, &tracker->ctm[tracker->top]);
+  }
+  tracker->original.op_cm(ctx, proc, a, b, c, d, e, f);
+}
+
+static void
+mupdf_form_op_gs_begin(fz_context* ctx, pdf_processor* proc, const char* name, pdf_obj* extgstate)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_gs_begin(ctx, proc, name, extgstate);
+}
+
+static void
+mupdf_form_op_CS(fz_context* ctx, pdf_processor* proc, const char* name, fz_colorspace* cs)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_CS(ctx, proc, name, cs);
+}
+
+static void
+mupdf_form_op_cs(fz_context* ctx, pdf_processor* proc, const char* name, fz_colorspace* cs)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_cs(ctx, proc, name, cs);
+}
+
+static void
+mupdf_form_op_SC_pattern(fz_context* ctx, pdf_processor* proc, const char* name, pdf_pattern* pat, int n, float* color)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_SC_pattern(ctx, proc, name, pat, n, color);
+}
+
+static void
+mupdf_form_op_sc_pattern(fz_context* ctx, pdf_processor* proc, const char* name, pdf_pattern* pat, int n, float* color)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_sc_pattern(ctx, proc, name, pat, n, color);
+}
+
+static void
+mupdf_form_op_SC_shade(fz_context* ctx, pdf_processor* proc, const char* name, fz_shade* shade)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_SC_shade(ctx, proc, name, shade);
+}
+
+static void
+mupdf_form_op_sc_shade(fz_context* ctx, pdf_processor* proc, const char* name, fz_shade* shade)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_sc_shade(ctx, proc, name, shade);
+}
+
+static void
+mupdf_form_op_SC_color(fz_context* ctx, pdf_processor* proc, int n, float* color)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_SC_color(ctx, proc, n, color);
+}
+
+static void
+mupdf_form_op_sc_color(fz_context* ctx, pdf_processor* proc, int n, float* color)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_sc_color(ctx, proc, n, color);
+}
+
+static void
+mupdf_form_op_G(fz_context* ctx, pdf_processor* proc, float g)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_G(ctx, proc, g);
+}
+
+static void
+mupdf_form_op_g(fz_context* ctx, pdf_processor* proc, float g)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_g(ctx, proc, g);
+}
+
+static void
+mupdf_form_op_RG(fz_context* ctx, pdf_processor* proc, float r, float g, float b)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_RG(ctx, proc, r, g, b);
+}
+
+static void
+mupdf_form_op_rg(fz_context* ctx, pdf_processor* proc, float r, float g, float b)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_rg(ctx, proc, r, g, b);
+}
+
+static void
+mupdf_form_op_K(fz_context* ctx, pdf_processor* proc, float c, float m, float y, float k)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_K(ctx, proc, c, m, y, k);
+}
+
+static void
+mupdf_form_op_k(fz_context* ctx, pdf_processor* proc, float c, float m, float y, float k)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_k(ctx, proc, c, m, y, k);
+}
+
+static void
+mupdf_form_op_w(fz_context* ctx, pdf_processor* proc, float linewidth)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_w(ctx, proc, linewidth);
+}
+
+static void
+mupdf_form_op_j(fz_context* ctx, pdf_processor* proc, int linejoin)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_j(ctx, proc, linejoin);
+}
+
+static void
+mupdf_form_op_J(fz_context* ctx, pdf_processor* proc, int linecap)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_J(ctx, proc, linecap);
+}
+
+static void
+mupdf_form_op_M(fz_context* ctx, pdf_processor* proc, float miterlimit)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_M(ctx, proc, miterlimit);
+}
+
+static void
+mupdf_form_op_d(fz_context* ctx, pdf_processor* proc, pdf_obj* array, float phase)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_d(ctx, proc, array, phase);
+}
+
+static void
+mupdf_form_op_ri(fz_context* ctx, pdf_processor* proc, const char* intent)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_ri(ctx, proc, intent);
+}
+
+static void
+mupdf_form_op_i(fz_context* ctx, pdf_processor* proc, float flatness)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_i(ctx, proc, flatness);
+}
+
+static void
+mupdf_form_op_Tc(fz_context* ctx, pdf_processor* proc, float charspace)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_Tc(ctx, proc, charspace);
+}
+
+static void
+mupdf_form_op_Tw(fz_context* ctx, pdf_processor* proc, float wordspace)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_Tw(ctx, proc, wordspace);
+}
+
+static void
+mupdf_form_op_Tz(fz_context* ctx, pdf_processor* proc, float scale)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_Tz(ctx, proc, scale);
+}
+
+static void
+mupdf_form_op_TL(fz_context* ctx, pdf_processor* proc, float leading)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_TL(ctx, proc, leading);
+}
+
+static void
+mupdf_form_op_Tf(fz_context* ctx, pdf_processor* proc, const char* name, pdf_font_desc* font, float size)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_Tf(ctx, proc, name, font, size);
+}
+
+static void
+mupdf_form_op_Tr(fz_context* ctx, pdf_processor* proc, int render)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_Tr(ctx, proc, render);
+}
+
+static void
+mupdf_form_op_Ts(fz_context* ctx, pdf_processor* proc, float rise)
+{
+  mupdf_form_mark_dirty();
+  mupdf_form_tracker()->original.op_Ts(ctx, proc, rise);
+}
+
+/* Runs the form like the run processor does for Do, in a graphics state
+ * that is default apart from the CTM, which is applied when replaying */
+static fz_display_list*
+mupdf_form_record(fz_context* ctx, pdf_document* document, pdf_xobject* form)
+{
+  fz_display_list* display_list = NULL;
+  fz_device* device             = NULL;
+  fz_path* path                 = NULL;
+  pdf_processor* proc           = NULL;
+
+  fz_var(display_list);
+  fz_var(device);
+  fz_var(path);
+  fz_var(proc);
+
+  fz_try (ctx) {
+    /* record in the coordinate space the form is drawn in, including its
+     * matrix and the clip to its bounding box */
+    fz_rect bounds = form->bbox;
+    fz_transform_rect(&bounds, &form->matrix);
+
+    display_list = fz_new_display_list(ctx, &bounds);
+    device       = fz_new_list_device(ctx, display_list);
+
+    path = fz_new_path(ctx);
+    fz_rectto(ctx, path, form->bbox.x0, form->bbox.y0, form->bbox.x1, form->bbox.y1);
+    fz_clip_path(ctx, device, path, 0, &form->matrix, &bounds);
+
+    /* recorded without a cookie, an aborted recording must not be cached */
+    proc = pdf_new_run_processor(ctx, device, &form->matrix, "View", NULL, 1);
+    pdf_process_contents(ctx, proc, document, form->resources, form->contents, NULL);
+
+    fz_pop_clip(ctx, device);
+    fz_close_device(ctx, device);
+  } fz_always (ctx) {
+    pdf_drop_processor(ctx, proc);
+    fz_drop_path(ctx, path);
+    fz_drop_device(ctx, device);
+  } fz_catch (ctx) {
+    fz_drop_display_list(ctx, display_list);
+    display_list = NULL;
+  }
+
+  return display_list;
+}
+
+static fz_display_list*
+mupdf_form_cache_lookup(fz_context* ctx, mupdf_form_tracker_t* tracker, pdf_xobject* form)
+{
+  GHashTable* cache = tracker->mupdf_document->form_cache;
+
+  pdf_obj* resources = form->resources;
+  char* key = g_strdup_printf("%d %d %d", pdf_to_num(ctx, form->contents),
+      pdf_to_gen(ctx, form->contents),
+      pdf_is_indirect(ctx, resources) ? pdf_to_num(ctx, resources) : 0);
+
+  mupdf_form_entry_t* entry = g_hash_table_lookup(cache, key);
+  if (entry == NULL) {
+    if (g_hash_table_size(cache) < MUPDF_FORM_CACHE_SIZE) {
+      entry = g_malloc0(sizeof(mupdf_form_entry_t));
+      entry->uses = 1;
+      g_hash_table_insert(cache, key, entry);
+    } else {
+      g_free(key);
+    }
+    return NULL;
+  }
+
+  g_free(key);
+
+  /* forms drawn only once are not worth a display list */
+  if (entry->display_list == NULL && ++entry->uses >= 2) {
+    entry->display_list = mupdf_form_record(ctx, tracker->document, form);
+  }
+
+  if (entry->display_list == NULL) {
+    return NULL;
+  }
+
+  return fz_keep_display_list(ctx, entry->display_list);
+}
+
+static void
+mupdf_form_op_Do_form(fz_context* ctx, pdf_processor* proc, const char* name,
+    pdf_xobject* form, pdf_obj* page_resources)
+{
+  mupdf_form_tracker_t* tracker = mupdf_form_tracker();
+
+  /* only forms that do not depend on inherited colour, line, text or
+   * transparency state can be replayed independently of the page */
+  if (tracker->nesting == 0 && tracker->top < MUPDF_FORM_MAX_GSTATES &&
+      tracker->dirty[tracker->top] == false && form->transparency == 0 &&
+      form->resources != NULL && pdf_is_indirect(ctx, form->contents)) {
+    fz_display_list* display_list = mupdf_form_cache_lookup(ctx, tracker, form);
+    if (display_list != NULL) {
+      /* running a display list resets the progress of its cookie, which
+       * counts the operators of the whole page, so only the abort flag is
+       * passed through */
+      fz_cookie replay = { 0 };
+      if (tracker->cookie != NULL) {
+        replay.abort = tracker->cookie->abort;
+      }
+
+      fz_try (ctx) {
+        fz_run_display_list(ctx, display_list, tracker->device,
+            &tracker->ctm[tracker->top], &fz_infinite_rect, &replay);
+      } fz_always (ctx) {
+        fz_drop_display_list(ctx, display_list);
+        if (tracker->cookie != NULL && replay.abort != 0) {
+          tracker->cookie->abort = 1;
+        }
+      } fz_catch (ctx) {
+        fz_rethrow(ctx);
+      }
+      return;
+    }
+  }
+
+  tracker->nesting++;
+  fz_try (ctx) {
+    tracker->original.op_Do_form(ctx, proc, name, form, page_resources);
+  } fz_always (ctx) {
+    tracker->nesting--;
+  } fz_catch (ctx) {
+    fz_rethrow(ctx);
+  }
+}
+
+static void
+mupdf_form_tracker_install(mupdf_form_tracker_t* tracker, pdf_processor* proc)
+{
+  memcpy(&tracker->original, proc, sizeof(pdf_processor));
+
+  proc->op_q          = mupdf_form_op_q;
+  proc->op_Q          = mupdf_form_op_Q;
+  proc->op_cm         = mupdf_form_op_cm;
+  proc->op_gs_begin   = mupdf_form_op_gs_begin;
+  proc->op_CS         = mupdf_form_op_CS;
+  proc->op_cs         = mupdf_form_op_cs;
+  proc->op_SC_pattern = mupdf_form_op_SC_pattern;
+  proc->op_sc_pattern = mupdf_form_op_sc_pattern;
+  proc->op_SC_shade   = mupdf_form_op_SC_shade;
+  proc->op_sc_shade   = mupdf_form_op_sc_shade;
+  proc->op_SC_color   = mupdf_form_op_SC_color;
+  proc->op_sc_color   = mupdf_form_op_sc_color;
+  proc->op_G          = mupdf_form_op_G;
+  proc->op_g          = mupdf_form_op_g;
+  proc->op_RG         = mupdf_form_op_RG;
+  proc->op_rg         = mupdf_form_op_rg;
+  proc->op_K          = mupdf_form_op_K;
+  proc->op_k          = mupdf_form_op_k;
+  proc->op_w          = mupdf_form_op_w;
+  proc->op_j          = mupdf_form_op_j;
+  proc->op_J          = mupdf_form_op_J;
+  proc->op_M          = mupdf_form_op_M;
+  proc->op_d          = mupdf_form_op_d;
+  proc->op_ri         = mupdf_form_op_ri;
+  proc->op_i          = mupdf_form_op_i;
+  proc->op_Tc         = mupdf_form_op_Tc;
+  proc->op_Tw         = mupdf_form_op_Tw;
+  proc->op_Tz         = mupdf_form_op_Tz;
+  proc->op_TL         = mupdf_form_op_TL;
+  proc->op_Tf         = mupdf_form_op_Tf;
+  proc->op_Tr         = mupdf_form_op_Tr;
+  proc->op_Ts         = mupdf_form_op_Ts;
+  proc->op_Do_form    = mupdf_form_op_Do_form;
+}
+
+void
+mupdf_page_run_contents(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, fz_device* device, const fz_matrix* ctm,
+    fz_cookie* cookie)
+{
+  pdf_document* document = pdf_specifics(ctx, mupdf_document->document);
+  if (document == NULL || mupdf_document->form_cache == NULL) {
+    fz_run_page_contents(ctx, mupdf_page->page, device, ctm, cookie);
+    return;
+  }
+
+  pdf_page* page = (pdf_page*) mupdf_page->page;
+
+  mupdf_form_tracker_t tracker = { 0 };
+  tracker.mupdf_document       = mupdf_document;
+  tracker.document             = document;
+  tracker.device               = device;
+  tracker.cookie               = cookie;
+
+  fz_rect mediabox;
+  fz_matrix page_ctm;
+  pdf_page_transform(ctx, page, &mediabox, &page_ctm);
+  fz_concat(&tracker.ctm[0], &page_ctm, ctm);
+
+  pdf_processor* proc = NULL;
+  bool group          = false;
+
+  fz_var(proc);
+  fz_var(group);
+
+  g_private_set(&mupdf_form_tracker_key, &tracker);
+
+  fz_try (ctx) {
+    if (page->transparency) {
+      fz_rect bounds = mediabox;
+      fz_transform_rect(&bounds, &tracker.ctm[0]);
+      fz_begin_group(ctx, device, &bounds, 1, 0, 0, 1);
+      group = true;
+    }
+
+    proc = pdf_new_run_processor(ctx, device, &tracker.ctm[0], "View", NULL, 0);
+    mupdf_form_tracker_install(&tracker, proc);
+
+    pdf_process_contents(ctx, proc, document, page->resources, page->contents, cookie);
+  } fz_always (ctx) {
+    pdf_drop_processor(ctx, proc);
+    if (group == true) {
+      fz_end_group(ctx, device);
+    }
+    g_private_set(&mupdf_form_tracker_key, NULL);
+  } fz_catch (ctx) {
+    fz_rethrow(ctx);
+  }
+}
+
+void
+mupdf_form_cache_reset(fz_context* ctx, mupdf_document_t* mupdf_document)
+{
+  if (mupdf_document == NULL || mupdf_document->form_cache == NULL) {
+    return;
+  }
+
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init(&iter, mupdf_document->form_cache);
+  while (g_hash_table_iter_next(&iter, NULL, &value) == TRUE) {
+    mupdf_form_entry_t* entry = value;
+    fz_drop_display_list(ctx, entry->display_list);
+    g_free(entry);
+    g_hash_table_iter_remove(&iter);
+  }
+}
+
+void
+mupdf_form_cache_clear(fz_context* ctx, mupdf_document_t* mupdf_document)
+{
+  if (mupdf_document == NULL || mupdf_document->form_cache == NULL) {
+    return;
+  }
+
+  mupdf_form_cache_reset(ctx, mupdf_document);
+
+  g_hash_table_destroy(mupdf_document->form_cache);
+  mupdf_document->form_cache = NULL;
+}
@@ -0,0 +1,45 @@
+/* See LICENSE file for license and copyright information */
+
+#ifndef XOBJECT_H
+#define XOBJECT_H
+
+#include "plugin.h"
+
+/** Maximum number of Form XObjects tracked per document */
+#define MUPDF_FORM_CACHE_SIZE 256
+
+/**
+ * Runs the contents of a page (without annotations) through a device. For
+ * PDF pages, Form XObjects drawn on more than one page are recorded into a
+ * display list once and replayed instead of being interpreted again. Has to
+ * be called with the document mutex held.
+ *
+ * @param ctx Context of the calling thread
+ * @param mupdf_document Document
+ * @param mupdf_page Page
+ * @param device Target device
+ * @param ctm Transformation
+ * @param cookie Cookie used to abort the run or NULL
+ */
+void mupdf_page_run_contents(fz_context* ctx, mupdf_document_t* mupdf_document,
+    mupdf_page_t* mupdf_page, fz_device* device, const fz_matrix* ctm,
+    fz_cookie* cookie);
+
+/**
+ * Drops all recorded forms, e.g. because the visible layers changed. Has to
+ * be called with the document mutex held.
+ *
+ * @param ctx Context
+ * @param mupdf_document Document
+ */
+void mupdf_form_cache_reset(fz_context* ctx, mupdf_document_t* mupdf_document);
+
+/**
+ * Frees the Form XObject cache of the document
+ *
+ * @param ctx Context
+ * @param mupdf_document Document
+ */
+void mupdf_form_cache_clear(fz_context* ctx, mupdf_document_t* mupdf_document);
+
+#endif // XOBJECT_H